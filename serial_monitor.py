@@ -1,7 +1,15 @@
 import serial
 import sys
 
-s = serial.Serial(sys.argv[1], 9600, timeout = 1)
+# Listens in on the ring: serial_monitor.py PORT [BAUD]
+# A frame is SYNC CNTR AGE OPC DATA0..6 LATE_H LATE_L CHECKSUM, see src/uart.c. After
+# SYNC a SYNC or ESC byte comes as ESC and the byte ^ 0x20.
+SYNC = ord('s')
+ESC = 0x7D
+FRAME = 14
+
+baud = int(sys.argv[2]) if len(sys.argv) > 2 else 9600
+s = serial.Serial(sys.argv[1], baud, timeout = 1)
 
 def m(v):
     if v >= 65 and v <= 122:
@@ -9,12 +17,60 @@ def m(v):
     else:
         return int(v)
 
+# Round trip bytes are in 256 counts of FOSC / 12, hold in 32
+COUNT_MS = 12 * 1000 / 11059200
+
+# CRC-8, x^8 + x^2 + x + 1, seeded with SYNC
+def crc8(data, crc = SYNC):
+    for b in data:
+        crc ^= b
+        for i in range(8):
+            crc = ((crc << 1) ^ 0x07 if crc & 0x80 else crc << 1) & 0xFF
+    return crc
+
+def link(d):
+    hops = d[1] or 1
+    return "id %d: %d hops, round trip %.1f/%.1f/%.1f ms, %.2f ms per hop, held max %.2f ms" % (
+        d[0], d[1], d[2] * 256 * COUNT_MS, d[3] * 256 * COUNT_MS, d[4] * 256 * COUNT_MS,
+        d[3] * 256 * COUNT_MS / hops, d[5] * 32 * COUNT_MS)
+
+# Longest task in 256 counts, longest interrupt in 8, see src/ringstat.c
+def stats(d):
+    return "id %d: %d bad checksums, %d rx overruns, %d button drops, task max %.1f ms, isr max %.3f ms" % (
+        d[0], d[1], d[2], d[3], d[4] * 256 * COUNT_MS, d[5] * 8 * COUNT_MS)
+
+# The rest of a frame after its SYNC, None if it broke off
+def frame():
+    b = bytes([SYNC])
+    esc = False
+    while len(b) != FRAME:
+        c = s.read(1)
+        if len(c) == 0 or c[0] == SYNC:
+            return None, c
+        if c[0] == ESC:
+            esc = True
+        else:
+            b += bytes([c[0] ^ 0x20 if esc else c[0]])
+            esc = False
+    return b, b''
+
 s.reset_input_buffer()
+c = b''
 while True:
-    b = s.read(6)
-    if len(b) == 0:
-        continue;
-    elif len(b) != 6:
+    if len(c) == 0:
+        c = s.read(1)
+    if len(c) == 0 or c[0] != SYNC:
+        c = b''
+        continue
+    b, c = frame()
+    if b is None:
         print("TRUNC")
-    l = map(m, b)
-    print(list(l))
+        continue
+    cntr, age, opc, d, chk = b[1], b[2], b[3], b[4:13], b[13]
+    ok = crc8(b[3:13]) == chk
+    if opc == ord('L') and ok:
+        print(link(d))
+    elif opc == ord('S') and ok:
+        print(stats(d))
+    else:
+        print(cntr, age, list(map(m, b[3:13])), "" if ok else "BAD")
@@ -0,0 +1,72 @@
+/* Host check of src/bcdtime.c: bcd_follow() stepping along a time as
+ * display_time() sees it must show what plain division gives. Ticks
+ * move by 0..2 most of the time, now and then they jump either way,
+ * across a minute and up to and past 99:59.99.
+ *
+ *   bcdcheck [steps [seed]]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "bcdtime.h"
+
+#define TIME_UNKNOWN    0xFFFFFFUL  // as main.c has it
+#define SHOWN_MAX       (100UL * 60 * 100 - 1)      // ticks of 10ms
+
+static uint8_t to_bcd(unsigned v)
+{
+    return (v / 10) << 4 | v % 10;
+}
+
+static int check(const struct BcdTime *t, uint32_t ticks, unsigned long step)
+{
+    uint32_t v = ticks > SHOWN_MAX ? SHOWN_MAX : ticks;
+    uint8_t min = to_bcd(v / 6000), sec = to_bcd(v / 100 % 60), cs = to_bcd(v % 100);
+
+    if (t->min == min && t->sec == sec && t->cs == cs)
+        return 0;
+    fprintf(stderr, "step %lu: %lu ticks shown as %02x:%02x.%02x, want %02x:%02x.%02x\n",
+            step, (unsigned long)ticks, t->min, t->sec, t->cs, min, sec, cs);
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long steps = argc > 1 ? strtoul(argv[1], NULL, 0) : 2000000;
+    struct BcdTime t = { 0 };
+    uint32_t ticks = 0;
+    unsigned long i;
+    int bad = 0;
+
+    srandom(argc > 2 ? strtoul(argv[2], NULL, 0) : 1);
+    for (unsigned v = 0; v != 100; v++)
+        bad |= bcd(v) != to_bcd(v);
+    bad |= check(&t, 0, 0);
+
+    for (i = 1; i <= steps && !bad; i++) {
+        long r = random();
+        switch (r % 64) {
+        case 0:     // a jump to anywhere
+            ticks = random() % (SHOWN_MAX + 1000);
+            break;
+        case 1:     // to the edge of stepping
+            ticks += (r >> 6) % 40 - 20;
+            break;
+        case 2:
+            ticks = r & 64 ? TIME_UNKNOWN : SHOWN_MAX - (r >> 7) % 20;
+            break;
+        default:    // a pass or two, running down or up
+            if (r & 64)
+                ticks += (r >> 7) % 3;
+            else
+                ticks -= ticks < 2 ? ticks : (r >> 7) % 3;
+            break;
+        }
+        if (ticks > TIME_UNKNOWN)
+            ticks = 0;
+        bcd_follow(&t, ticks);
+        bad |= check(&t, ticks, i);
+    }
+    printf("bcd      %s  %lu steps\n", bad ? "FAIL" : "ok ", i - 1);
+    return bad;
+}
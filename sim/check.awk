@@ -0,0 +1,32 @@
+# Reads a ringsim report, prints one line for it and fails when the
+# ring stalled, a queue overran or the time was off by more than
+#   err    ms on any move
+#   ppm    the tick rate of any clock over the second half of the run
+# Run with: awk -v name=.. -v err=.. -v ppm=.. -f sim/check.awk report
+
+/^time accounting/ {
+    for (i = 1; i < NF; i++)
+        if ($i == "max|err|")
+            e = $(i + 1)
+    if (e > err)
+        bad = bad sprintf(" time off by %d ms", e)
+}
+/^queues:/ {
+    if ($2 > 0)
+        bad = bad sprintf(" %d rx overruns", $2)
+}
+/^tick rate/ {
+    lo = $6; hi = $8
+    if (-lo > ppm || hi > ppm)
+        bad = bad sprintf(" tick rate %s .. %s ppm", lo, hi)
+}
+/^STALLED/ { bad = bad " stalled" }
+/^ring:/ { ring = $0 }
+
+END {
+    if (bad != "") {
+        printf "%-8s FAIL%s\n", name, bad
+        exit 1
+    }
+    printf "%-8s ok  %s\n", name, ring
+}
@@ -0,0 +1,64 @@
+/* Per-instance state of the simulated HAL.
+ *
+ * Linked into firmware.so together with the firmware itself. The
+ * simulator dlopen()s a private copy of the library for every clock, so
+ * all of these (and every static in the firmware) exist once per clock. */
+
+#include <stdint.h>
+#include "sim_hal.h"
+
+#define HAL_DEFINE(type, name) volatile type name;
+HAL_REGS(HAL_DEFINE)
+#undef HAL_DEFINE
+
+/* Filled in by the simulator */
+void *hal_ctx;
+void (*hal_yield_cb)(void *ctx);
+void (*hal_trace_cb)(void *ctx, uint8_t ev, uint32_t arg);
+uint8_t (*hal_ds_cb)(void *ctx, uint8_t op, uint8_t b);
+void (*hal_iap_cb)(void *ctx);
+uint16_t (*hal_timer0_cb)(void *ctx);
+
+void hal_yield(void)
+{
+    hal_yield_cb(hal_ctx);
+}
+
+void hal_trace(uint8_t ev, uint32_t arg)
+{
+    if (hal_trace_cb)
+        hal_trace_cb(hal_ctx, ev, arg);
+}
+
+/* Without a DS1302 the data line floats high */
+static uint8_t hal_ds(uint8_t op, uint8_t b)
+{
+    return hal_ds_cb ? hal_ds_cb(hal_ctx, op, b) : 0xFF;
+}
+
+void hal_ds_start(uint8_t cmd)
+{
+    hal_ds(HAL_DS_START, cmd);
+}
+
+void hal_ds_write(uint8_t b)
+{
+    hal_ds(HAL_DS_WRITE, b);
+}
+
+uint8_t hal_ds_read(void)
+{
+    return hal_ds(HAL_DS_READ, 0);
+}
+
+void hal_iap(void)
+{
+    if (hal_iap_cb)
+        hal_iap_cb(hal_ctx);
+}
+
+/* Without the simulator the count stands at the reload */
+uint16_t hal_timer0_count(void)
+{
+    return hal_timer0_cb ? hal_timer0_cb(hal_ctx) : TH0 << 8 | TL0;
+}
@@ -0,0 +1,41 @@
+#ifndef HAL_REGS_H
+#define HAL_REGS_H
+
+/* The special function registers the firmware touches, as seen by the
+ * host build. Every firmware instance gets its own copy of these
+ * (sim/hal.c), the simulator finds them by name.
+ *
+ * SBUF is wider than on the chip: the simulator parks it at SBUF_IDLE
+ * (or SBUF_IDLE | rx byte) and anything else in the high byte means the
+ * firmware wrote a byte to transmit. Only the low byte of such a write
+ * goes out, like `SBUF = cntr + 1` truncating on the real thing. */
+#define SBUF_IDLE       0xFF00
+#define SBUF_WRITTEN(v) (((v) & 0xFF00) != SBUF_IDLE)
+
+#define HAL_REGS(X) \
+    X(uint8_t,  P0)        X(uint8_t,  P1)        X(uint8_t,  P2) \
+    X(uint8_t,  P3)        X(uint8_t,  P0_0)      X(uint8_t,  P0_1) \
+    X(uint8_t,  P1_0)      X(uint8_t,  P1_1)      X(uint8_t,  P1_2) \
+    X(uint8_t,  P1_3)      X(uint8_t,  P1_4)      X(uint8_t,  P1_5) \
+    X(uint8_t,  P1_6)      X(uint8_t,  P1_7)      X(uint8_t,  P3_0) \
+    X(uint8_t,  P3_1)      X(uint8_t,  P3_2)      X(uint8_t,  P3_3) \
+    X(uint8_t,  P3_6)      X(uint8_t,  P3_7) \
+    X(uint8_t,  EA)        X(uint8_t,  ES)        X(uint8_t,  ET0) \
+    X(uint8_t,  TF0)       X(uint8_t,  TR0)       X(uint8_t,  TMOD) \
+    X(uint8_t,  TH0)       X(uint8_t,  TL0)       X(uint8_t,  AUXR) \
+    X(uint8_t,  T2H)       X(uint8_t,  T2L)       X(uint8_t,  SM0) \
+    X(uint8_t,  SM1)       X(uint8_t,  REN)       X(uint8_t,  RI) \
+    X(uint8_t,  TI)        X(uint16_t, SBUF)      X(uint8_t,  PCON) \
+    X(uint8_t,  WDT_CONTR) X(uint8_t,  P_SW1)     X(uint8_t,  CLK_DIV) \
+    X(uint8_t,  P1ASF)     X(uint8_t,  ADC_CONTR) X(uint8_t,  ADC_RES) \
+    X(uint8_t,  ADC_RESL)  X(uint8_t,  EADC)      X(uint8_t,  IE2) \
+    X(uint8_t,  INT_CLKO)  X(uint8_t,  WKTCL)     X(uint8_t,  WKTCH) \
+    X(uint8_t,  IAP_DATA)  X(uint8_t,  IAP_ADDRH) X(uint8_t,  IAP_ADDRL) \
+    X(uint8_t,  IAP_CMD)   X(uint8_t,  IAP_TRIG)  X(uint8_t,  IAP_CONTR)
+
+/* The DS1302 is bit-banged on the chip, the host build hands the
+ * simulator whole bytes instead: a transfer starts with the command
+ * byte, the data bytes follow one by one */
+enum HalDsOp { HAL_DS_START, HAL_DS_WRITE, HAL_DS_READ };
+
+#endif /* HAL_REGS_H */
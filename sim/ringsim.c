@@ -0,0 +1,1330 @@
+/* Discrete-event simulator for a ring of chess clocks.
+ *
+ * Every clock is a private dlopen()ed copy of firmware.so (the real
+ * firmware built against sim/hal.c). main() of each copy runs as a
+ * coroutine that yields once per main loop pass; timer0 and uart1
+ * interrupts are delivered at the simulated time they would fire.
+ * TX of clock i is wired to RX of clock i+1, the last one closes the
+ * ring back to clock 0.
+ *
+ * Scripted players start the game on clock 0, then every clock whose
+ * time starts running "thinks" for a random while and presses S3.
+ * At the end it reports per-move handoff latency, frames per move and
+ * how far the time charged by the firmware is off from the real time
+ * the player used. Everything is driven by --seed, so runs repeat. */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "hal_regs.h"
+#include "trace.h"
+#include "linkstat.h"
+
+#ifndef FOSC
+#define FOSC 11059200UL
+#endif
+
+#define NS_PER_MS       1000000ULL
+#define NS_PER_S        1000000000ULL
+#define MAX_NODES       64
+#define FW_STACK_SIZE   (256 * 1024)
+#define PRESS_HOLD_MS   200     // a short press, long is 800ms
+#define FW_SM_BTN       6       // state of the clock whose time runs, main.c
+
+/* ---------------------------------------------------------------------
+ * Options
+ * ------------------------------------------------------------------ */
+static struct {
+    const char *firmware;
+    int nodes;
+    long baud;
+    int moves;
+    unsigned long seed;
+    long think_min_ms;
+    long think_max_ms;
+    long hold_ms;               // S3 held down this long on a move
+    long loop_us;
+    long idle_us;               // a pass that finds nothing to do
+    long stall_ms;
+    int link;                   // clock whose TX line is limited, -1 none
+    long link_baud;             // fastest rate that link carries cleanly
+    long link_from_ms;          // limit applies from here on
+    long rc_ppm;                // spread of the RC oscillators
+    long timer_isr_clk;         // CPU clocks one timer0 interrupt takes
+    long uart_isr_clk;          // .. and one uart1 interrupt
+    long adc_isr_clk;           // .. and one adc interrupt
+    long light;                 // what the LDR reads, 0 bright .. 1023 dark
+    long light_noise;           // give or take
+    bool sleep;                 // clocks may power down while waiting
+    bool debug;                 // .. run in debug mode, sending OPC_LINK
+    int reboot;                 // clock that gets power cycled, -1 none
+    bool no_battery;            // .. and its DS1302 forgets everything
+    long reboot_ms;             // .. at this point into the run
+    long reboot_off_ms;         // .. for this long
+    bool verbose;
+} opt = {
+    .firmware = "build/host/firmware.so",
+    .nodes = 4,
+    .baud = 0,
+    .moves = 20,
+    .seed = 1,
+    .think_min_ms = 1000,
+    .think_max_ms = 5000,
+    .hold_ms = PRESS_HOLD_MS,
+    .loop_us = 200,
+    .idle_us = 20,
+    .stall_ms = 30000,
+    .link = -1,
+    .reboot = -1,
+    .reboot_off_ms = 300,
+    /* Rough counts off the sdcc listings, entry and exit included */
+    .timer_isr_clk = 150,
+    .uart_isr_clk = 250,
+    .adc_isr_clk = 120,
+    .light = 512,
+    .light_noise = 16,
+};
+
+/* ---------------------------------------------------------------------
+ * Nodes
+ * ------------------------------------------------------------------ */
+struct regs {
+#define REG_PTR(type, name) volatile type *name;
+    HAL_REGS(REG_PTR)
+#undef REG_PTR
+};
+
+/* Data flash, the two sectors journal.c uses. Programming a byte
+ * takes some 55us and erasing a sector 21ms, the CPU stands still and
+ * interrupts wait: of the timer0 overflows meanwhile only one is taken,
+ * of the bytes coming in only the first. */
+#define EEPROM_SIZE     1024
+#define EEPROM_SECTOR   512
+#define IAP_PROGRAM_NS  55000
+#define IAP_ERASE_NS    21000000
+enum { IAP_CMD_READ = 1, IAP_CMD_PROGRAM, IAP_CMD_ERASE };
+
+/* DS1302 on the board: seconds off a crystal, 31 bytes of RAM */
+struct ds1302 {
+    uint64_t offset_ns;         // how far into a second it was at power up
+    uint8_t ram[31];
+    uint8_t cmd;                // command of the transfer in progress
+    uint8_t idx;                // data bytes moved since
+};
+
+struct node {
+    int idx;
+    void *dl;
+    uint32_t boot;              // events of an earlier power up are stale
+    bool off;
+    struct regs r;
+    int (*fw_main)(void);
+    void (*timer0_isr)(void);
+    void (*uart1_isr)(void);
+    void (*adc_isr)(void);
+    void (*int4_isr)(void);
+
+    ucontext_t ctx;
+    void *stack;
+
+    /* TX line towards the next node */
+    bool tx_busy;
+    uint8_t tx_byte;
+    uint32_t tx_gen;
+
+    /* Bookkeeping of the player on this clock */
+    int state;
+    uint32_t start_ms;          // firmware remaining time at clock start
+    uint64_t think_ns;          // real time used for the move in progress
+    bool press_lost;            // S3 went down while it was not counting
+    uint64_t t_claim;           // own CLAIM sent
+
+    /* Statistics */
+    uint64_t timer_isrs;
+    uint64_t uart_isrs;
+    uint64_t loops;
+    uint64_t timer_isr_ns;      // CPU time taken from the main loop
+    uint64_t uart_isr_ns;
+    uint64_t adc_isrs;
+    uint64_t adc_isr_ns;
+    bool adc_busy;              // conversion running
+    uint64_t isr_ns_mark;       // both at the start of the loop pass
+    uint8_t digits_lit;         // digit drivers on P3, as last seen
+    uint64_t digits_since;
+    uint64_t digit_ns[4];       // time each digit was lit
+    volatile uint8_t *dbuf_show;    // which segment buffer is scanned
+    uint8_t dbuf_shown;
+    uint64_t display_swaps;
+    uint64_t tx_overruns;
+    volatile uint8_t *rx_overruns;  // firmware's own queue counters
+    volatile uint8_t *tx_drops;
+    volatile uint8_t *btn_drops;
+    volatile uint32_t *tick_count;
+    struct LinkStat *link_rtt;      // what the firmware measured
+    struct LinkStat *link_hold;
+
+    /* Power saving */
+    bool idle;                  // PCON IDL: until the next interrupt
+    bool down;                  // PCON PD: oscillator stopped ..
+    bool waking;                // .. and coming back
+    bool int4_pending;
+    bool sleep_soon;            // the pass in progress set IDL or PD ..
+    bool sleep_cancel;          // .. but an interrupt came in meanwhile
+    uint64_t sleep_since;
+    uint64_t awake_at;          // oscillator running again from here
+    uint64_t idle_ns, down_ns;
+    uint64_t wakeups;
+    uint64_t wake_lost;         // bytes that came in while down
+    uint32_t timer_gen;         // timer0 events of a stopped timer are stale
+    uint64_t t0_start;          // timer0 counts up from t0_loaded since
+    uint16_t t0_loaded;
+    uint32_t wkt_gen;
+
+    /* Board */
+    double rc_ppm;              // how far off its RC runs
+    struct ds1302 ds;
+    uint8_t eeprom[EEPROM_SIZE];
+    uint64_t iap_programs, iap_erases;
+    uint64_t iap_ns;            // CPU stood still for IAP
+    uint64_t held_until;        // .. and takes no interrupt before this
+    bool t0_pending, adc_pending;
+    uint64_t held_timer_lost;   // timer0 interrupts that never came
+    uint64_t held_rx_lost;      // bytes in while RI was still set
+};
+
+static struct node nodes[MAX_NODES];
+
+/* tick_count of every clock every SAMPLE_S, to see the rate they
+ * settle at with --rc-ppm. One taken in power down is stale, the
+ * tick only catches up when the clock wakes. */
+#define SAMPLE_S        60
+struct sample {
+    uint32_t tick;
+    bool down;
+    uint32_t boot;
+};
+static struct sample (*samples)[MAX_NODES];
+static size_t samples_len;
+static ucontext_t sim_ctx;
+static struct node *running;
+static uint64_t now;            // simulated time in ns
+
+/* ---------------------------------------------------------------------
+ * Event queue, a binary heap ordered on (time, seq)
+ * ------------------------------------------------------------------ */
+enum EvType {
+    EV_LOOP,        // run one main loop pass
+    EV_TIMER,       // timer0 overflow
+    EV_TX_DONE,     // last bit of a byte left the wire
+    EV_PIN,         // player changes a button
+    EV_STALL,       // nothing happened for too long
+    EV_SAMPLE,      // note every tick_count, every SAMPLE_S
+    EV_ADC,         // conversion done
+    EV_SLEEP,       // end of a pass that set IDL or PD
+    EV_WKT,         // power down wake up timer
+    EV_WAKE,        // oscillator running again after power down
+    EV_POWER,       // --reboot: power off (arg 0) or back on (1)
+    EV_RESUME,      // IAP done, interrupts that waited are taken
+};
+
+struct event {
+    uint64_t t;
+    uint64_t seq;
+    enum EvType type;
+    struct node *n;
+    uint32_t arg;
+    uint32_t boot;              // of n when scheduled
+};
+
+static struct event *heap;
+static size_t heap_len, heap_cap;
+static uint64_t heap_seq;
+
+static bool ev_before(const struct event *a, const struct event *b)
+{
+    return a->t < b->t || (a->t == b->t && a->seq < b->seq);
+}
+
+static void schedule(uint64_t t, enum EvType type, struct node *n, uint32_t arg)
+{
+    if (heap_len == heap_cap) {
+        heap_cap = heap_cap ? heap_cap * 2 : 256;
+        heap = realloc(heap, heap_cap * sizeof(*heap));
+        if (!heap) {
+            perror("realloc");
+            exit(2);
+        }
+    }
+    size_t i = heap_len++;
+    struct event ev = { t, heap_seq++, type, n, arg, n ? n->boot : 0 };
+    while (i && ev_before(&ev, &heap[(i - 1) / 2])) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = ev;
+}
+
+static struct event pop_event(void)
+{
+    struct event top = heap[0];
+    struct event last = heap[--heap_len];
+    size_t i = 0;
+    for (;;) {
+        size_t c = 2 * i + 1;
+        if (c >= heap_len)
+            break;
+        if (c + 1 < heap_len && ev_before(&heap[c + 1], &heap[c]))
+            c++;
+        if (!ev_before(&heap[c], &last))
+            break;
+        heap[i] = heap[c];
+        i = c;
+    }
+    heap[i] = last;
+    return top;
+}
+
+/* ---------------------------------------------------------------------
+ * Deterministic random numbers (xorshift64*)
+ * ------------------------------------------------------------------ */
+static uint64_t rng_state;
+
+static uint64_t rng(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ULL;
+}
+
+static long rng_range(long lo, long hi)
+{
+    if (hi <= lo)
+        return lo;
+    return lo + (long)(rng() % (uint64_t)(hi - lo + 1));
+}
+
+/* ---------------------------------------------------------------------
+ * Statistics
+ * ------------------------------------------------------------------ */
+struct stat {
+    long n;
+    double min, max, sum, sum_abs;
+};
+
+static void stat_add(struct stat *s, double v)
+{
+    if (!s->n || v < s->min)
+        s->min = v;
+    if (!s->n || v > s->max)
+        s->max = v;
+    s->n++;
+    s->sum += v;
+    s->sum_abs += v < 0 ? -v : v;
+}
+
+static double stat_avg(const struct stat *s)
+{
+    return s->n ? s->sum / s->n : 0;
+}
+
+static struct {
+    bool started;               // some clock has started counting
+    bool awaiting_start;        // S3 pressed, next clock not counting yet
+    struct node *pressed;       // clock of the last press
+    struct node *holder;        // clock that started counting last
+    uint64_t t_press;           // time of the last press
+    uint64_t t_mark;            // start of the move in progress
+    uint64_t frames;
+    uint64_t frames_mark;
+    uint64_t rx_errors;
+    uint32_t stall_gen;
+    int moves;
+    bool done;
+    bool stalled;
+    struct stat latency_ms;
+    struct stat frames_per_move;
+    struct stat error_ms;
+    struct stat claim_rtt_ms;
+} game;
+
+/* ---------------------------------------------------------------------
+ * Hardware model
+ * ------------------------------------------------------------------ */
+static double timer0_count_ns(const struct node *n)
+{
+    uint32_t prescale = (*n->r.AUXR & 0x80) ? 1 : 12;   // T0x12
+    return prescale * (double)NS_PER_S / FOSC * (1 - n->rc_ppm * 1e-6);
+}
+
+static uint64_t timer0_period_ns(const struct node *n)
+{
+    uint32_t reload = ((uint32_t)*n->r.TH0 << 8) | *n->r.TL0;
+    return (uint64_t)((0x10000 - reload) * timer0_count_ns(n) + 0.5);
+}
+
+/* The timer (re)starts from the reload TL0/TH0 hold now */
+static void timer0_start(struct node *n, uint64_t t)
+{
+    n->t0_loaded = *n->r.TH0 << 8 | *n->r.TL0;
+    n->t0_start = t;
+    schedule(t + timer0_period_ns(n), EV_TIMER, n, n->timer_gen);
+}
+
+static uint16_t timer0_count_cb(void *ctx)
+{
+    struct node *n = ctx;
+    double counts = n->t0_loaded + (now - n->t0_start) / timer0_count_ns(n);
+    return counts < 0xFFFF ? (uint16_t)counts : 0xFFFF;
+}
+
+static long uart_baud(const struct node *n)
+{
+    uint32_t reload = ((uint32_t)*n->r.T2H << 8) | *n->r.T2L;
+    uint32_t counts = 0x10000 - reload;
+    uint32_t prescale = (*n->r.AUXR & 0x04) ? 1 : 12;   // T2x12
+    if (opt.baud)
+        return opt.baud;
+    return FOSC / prescale / 4 / counts;
+}
+
+static uint64_t byte_time_ns(const struct node *n)
+{
+    return 10 * NS_PER_S / uart_baud(n);    // start + 8 data + stop
+}
+
+static void stall_watch(uint64_t timeout_ms)
+{
+    schedule(now + timeout_ms * NS_PER_MS, EV_STALL, NULL, ++game.stall_gen);
+}
+
+/* Look at what the firmware did to the registers we model as side
+ * effects: a write to SBUF starts a transmission. */
+/* ADC_CONTR bits and the time a conversion takes at ADC_SPEEDLL, see
+ * adc.h. The LDR is on P1.6 (ADC_LIGHT), anything else reads mid scale. */
+#define ADC_FLAG        0x10
+#define ADC_START       0x08
+#define ADC_CLOCKS      540
+#define LDR_CHANNEL     6
+
+static uint16_t adc_sample(uint8_t chan)
+{
+    long v = chan == LDR_CHANNEL ? opt.light : 512;
+    v += rng_range(-opt.light_noise, opt.light_noise);
+    return v < 0 ? 0 : v > 1023 ? 1023 : v;
+}
+
+/* Digits are driven low on P3.2..5 (LED_DIGITS_PORT_BASE) */
+static void display_watch(struct node *n)
+{
+    uint8_t lit = (uint8_t)~*n->r.P3 >> 2 & 0xF;
+    if (*n->dbuf_show != n->dbuf_shown) {
+        n->dbuf_shown = *n->dbuf_show;
+        n->display_swaps++;
+    }
+    if (lit == n->digits_lit)
+        return;
+    for (int d = 0; d < 4; d++)
+        if (n->digits_lit & 1 << d)
+            n->digit_ns[d] += now - n->digits_since;
+    n->digits_lit = lit;
+    n->digits_since = now;
+}
+
+static void node_post(struct node *n)
+{
+    uint16_t sbuf = *n->r.SBUF;
+
+    display_watch(n);
+    if ((*n->r.ADC_CONTR & ADC_START) && !n->adc_busy) {
+        n->adc_busy = true;
+        schedule(now + ADC_CLOCKS * NS_PER_S / FOSC, EV_ADC, n, 0);
+    }
+    if (!SBUF_WRITTEN(sbuf))
+        return;
+    *n->r.SBUF = SBUF_IDLE;
+    if (n->tx_busy)
+        n->tx_overruns++;   // the shift register is reloaded, old byte lost
+    n->tx_busy = true;
+    n->tx_byte = (uint8_t)sbuf;
+    schedule(now + byte_time_ns(n), EV_TX_DONE, n, ++n->tx_gen);
+}
+
+/* PCON, INT_CLKO and the wake up timer, see power.c. The oscillator
+ * takes 32768 clocks to settle after power down. */
+#define PCON_IDL        0x01
+#define PCON_PD         0x02
+#define INT_CLKO_EX4    0x40
+#define WKT_HZ          2048
+#define WAKE_NS         (32768 * NS_PER_S / FOSC)
+#define RUN_CFG_DEBUG   (1 << 1)    // main.c
+#define RUN_CFG_SLEEP   (1 << 3)
+
+/* Also what IAP took: it stretches the pass it happened in, see
+ * iap_hold() for the interrupts */
+static uint64_t isr_ns_total(const struct node *n)
+{
+    return n->timer_isr_ns + n->uart_isr_ns + n->adc_isr_ns + n->iap_ns;
+}
+
+static void run_isr(struct node *n, void (*isr)(void), uint64_t *count,
+                    uint64_t *ns, long clk)
+{
+    if (n->down)
+        return;
+    running = n;
+    isr();
+    n->sleep_cancel |= n->sleep_soon;
+    (*count)++;
+    *ns += clk * NS_PER_S / FOSC;
+    node_post(n);
+    /* Any interrupt ends IDLE, the main loop goes on after it */
+    if (n->idle) {
+        n->idle = false;
+        n->idle_ns += now - n->sleep_since;
+        *n->r.PCON &= ~PCON_IDL;
+        n->isr_ns_mark = isr_ns_total(n);
+        schedule(now + clk * NS_PER_S / FOSC, EV_LOOP, n, 0);
+    }
+}
+
+/* The main loop set IDL or PD and handed back control */
+static void node_sleep(struct node *n)
+{
+    n->sleep_since = now;
+    if (!(*n->r.PCON & PCON_PD)) {
+        n->idle = true;
+        return;
+    }
+    n->down = true;
+    n->timer_gen++;     // timer0 stops with the oscillator
+    uint16_t wkt = *n->r.WKTCH << 8 | *n->r.WKTCL;
+    if (wkt & 0x8000)
+        schedule(now + ((wkt & 0x7FFF) + 1) * NS_PER_S / WKT_HZ, EV_WKT, n,
+                 ++n->wkt_gen);
+}
+
+/* Something woke a powered down clock at time t */
+static void node_wake(struct node *n, uint64_t t)
+{
+    if (!n->down || n->waking)
+        return;
+    n->waking = true;
+    schedule(t + WAKE_NS, EV_WAKE, n, 0);
+}
+
+static bool held(const struct node *n)
+{
+    return now < n->held_until;
+}
+
+static void uart_irq(struct node *n)
+{
+    if (held(n))
+        return;     // RI and TI stay set, EV_RESUME gets to them
+    if (*n->r.EA && *n->r.ES && (*n->r.RI || *n->r.TI))
+        run_isr(n, n->uart1_isr, &n->uart_isrs, &n->uart_isr_ns, opt.uart_isr_clk);
+}
+
+static void node_entry(void)
+{
+    running->fw_main();
+    fprintf(stderr, "node %d: main() returned\n", running->idx);
+    exit(2);
+}
+
+static void yield_cb(void *ctx)
+{
+    struct node *n = ctx;
+    swapcontext(&n->ctx, &sim_ctx);
+}
+
+static void schedule_press(struct node *n, uint64_t at, long hold_ms)
+{
+    schedule(at, EV_PIN, n, 0);
+    schedule(at + hold_ms * NS_PER_MS, EV_PIN, n, 1);
+}
+
+static void finish_move(void)
+{
+    if (game.moves >= opt.moves)
+        game.done = true;
+}
+
+static void trace_cb(void *ctx, uint8_t ev, uint32_t arg)
+{
+    struct node *n = ctx;
+
+    switch (ev) {
+    case TRACE_STATE:
+        if (opt.verbose && n->state != (int)arg)
+            printf("%10.3f node %2d state %u\n", now / 1e9, n->idx, arg);
+        n->state = arg;
+        /* A press it missed: the player tries again once the clock
+         * shows its time running */
+        if (n->press_lost && arg == FW_SM_BTN && !game.done) {
+            n->press_lost = false;
+            schedule_press(n, now + rng_range(opt.think_min_ms, opt.think_max_ms) * NS_PER_MS,
+                           opt.hold_ms);
+            stall_watch(opt.think_max_ms + opt.stall_ms);
+        }
+        break;
+
+    case TRACE_CLOCK_START:
+        if (opt.verbose)
+            printf("%10.3f node %2d clock start %u ms\n", now / 1e9, n->idx, arg);
+        if (game.awaiting_start) {
+            stat_add(&game.latency_ms, (now - game.t_press) / 1e6);
+            game.awaiting_start = false;
+            finish_move();
+        } else if (!game.started) {
+            game.t_mark = now;
+            game.frames_mark = game.frames;
+        } else if (n == game.holder) {
+            /* It lost the move with its RAM and got it back from the
+             * ring: still the same move, and the press is still due */
+            break;
+        }
+        game.started = true;
+        game.holder = n;
+        n->start_ms = arg;
+        if (!game.done) {
+            schedule_press(n, now + rng_range(opt.think_min_ms, opt.think_max_ms) * NS_PER_MS,
+                           opt.hold_ms);
+            stall_watch(opt.think_max_ms + opt.stall_ms);
+        }
+        break;
+
+    case TRACE_CLOCK_STOP:
+        if (opt.verbose)
+            printf("%10.3f node %2d clock stop %u ms\n", now / 1e9, n->idx, arg);
+        stat_add(&game.error_ms, (double)n->start_ms - arg - n->think_ns / 1e6);
+        break;
+
+    case TRACE_TX_FRAME:
+        if (opt.verbose)
+            printf("%10.3f node %2d tx %c\n", now / 1e9, n->idx, arg);
+        game.frames++;
+        break;
+
+    case TRACE_CLAIM_SENT:
+        n->t_claim = now;
+        break;
+
+    case TRACE_CLAIM_BACK:
+        if (game.started)
+            stat_add(&game.claim_rtt_ms, (now - n->t_claim) / 1e6);
+        break;
+
+    case TRACE_RX_ERROR:
+        if (opt.verbose)
+            printf("%10.3f node %2d rx error\n", now / 1e9, n->idx);
+        game.rx_errors++;
+        break;
+    }
+}
+
+static uint8_t bcd(unsigned v)
+{
+    return (v / 10) << 4 | v % 10;
+}
+
+static uint8_t ds_clock_reg(struct node *n, uint8_t addr)
+{
+    uint64_t s = (now + n->ds.offset_ns) / NS_PER_S;
+
+    switch (addr) {
+    case 0: return bcd(s % 60);
+    case 1: return bcd(s / 60 % 60);
+    case 2: return bcd(s / 3600 % 24);
+    case 3: return 0x01;                // day
+    case 4: return 0x01;                // month
+    case 5: return 0x01;                // weekday
+    default: return 0;                  // year, WP
+    }
+}
+
+static uint8_t ds_cb(void *ctx, uint8_t op, uint8_t b)
+{
+    struct node *n = ctx;
+    struct ds1302 *ds = &n->ds;
+    uint8_t addr = (ds->cmd >> 1) & 0x1F;
+    bool ram = ds->cmd & 0x40;
+    bool burst = addr == 31;
+    uint8_t v = 0xFF;
+
+    switch (op) {
+    case HAL_DS_START:
+        ds->cmd = b;
+        ds->idx = 0;
+        return 0;
+    case HAL_DS_WRITE:
+        /* Writes to the clock registers are ignored: it keeps
+         * running off the simulated crystal */
+        if (ram && (burst ? ds->idx < 31 : !ds->idx))
+            ds->ram[burst ? ds->idx : addr] = b;
+        break;
+    case HAL_DS_READ:
+        if (ram)
+            v = burst ? (ds->idx < 31 ? ds->ram[ds->idx] : 0xFF) : ds->ram[addr];
+        else
+            v = ds_clock_reg(n, burst ? ds->idx : addr);
+        break;
+    }
+    ds->idx++;
+    return v;
+}
+
+/* IAP stops the CPU for ns from the start of the pass on, or from the
+ * end of IAP before it in the same pass */
+static void iap_hold(struct node *n, uint64_t ns)
+{
+    n->held_until = (held(n) ? n->held_until : now) + ns;
+    schedule(n->held_until, EV_RESUME, n, 0);
+}
+
+static void iap_cb(void *ctx)
+{
+    struct node *n = ctx;
+    uint16_t addr = *n->r.IAP_ADDRH << 8 | *n->r.IAP_ADDRL;
+
+    if (!(*n->r.IAP_CONTR & 0x80))
+        return;     // IAPEN off
+    switch (*n->r.IAP_CMD) {
+    case IAP_CMD_READ:
+        *n->r.IAP_DATA = addr < EEPROM_SIZE ? n->eeprom[addr] : 0xFF;
+        break;
+    case IAP_CMD_PROGRAM:
+        /* Only takes bits from 1 to 0 */
+        if (addr < EEPROM_SIZE)
+            n->eeprom[addr] &= *n->r.IAP_DATA;
+        n->iap_programs++;
+        n->iap_ns += IAP_PROGRAM_NS;
+        iap_hold(n, IAP_PROGRAM_NS);
+        break;
+    case IAP_CMD_ERASE:
+        addr &= ~(EEPROM_SECTOR - 1);
+        if (addr < EEPROM_SIZE)
+            memset(n->eeprom + addr, 0xFF, EEPROM_SECTOR);
+        n->iap_erases++;
+        n->iap_ns += IAP_ERASE_NS;
+        iap_hold(n, IAP_ERASE_NS);
+        break;
+    }
+}
+
+static void node_load(struct node *n, int idx)
+{
+    char path[PATH_MAX];
+    const char *tmp = getenv("TMPDIR");
+
+    /* dlopen() hands out the same instance for the same file, so
+     * every clock gets a private copy of the library. */
+    snprintf(path, sizeof(path), "%s/ringsim-%d-XXXXXX", tmp ? tmp : "/tmp", idx);
+    int out = mkstemp(path);
+    FILE *in = fopen(opt.firmware, "rb");
+    if (out < 0 || !in) {
+        fprintf(stderr, "ringsim: %s: %s\n", out < 0 ? path : opt.firmware, strerror(errno));
+        exit(2);
+    }
+    char buf[65536];
+    size_t len;
+    while ((len = fread(buf, 1, sizeof(buf), in)) > 0) {
+        if (write(out, buf, len) != (ssize_t)len) {
+            perror("write");
+            exit(2);
+        }
+    }
+    fclose(in);
+    close(out);
+    n->dl = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    unlink(path);
+    if (!n->dl) {
+        fprintf(stderr, "ringsim: %s\n", dlerror());
+        exit(2);
+    }
+
+#define LOOKUP(dst, name) \
+    do { \
+        *(void **)&(dst) = dlsym(n->dl, name); \
+        if (!(dst)) { \
+            fprintf(stderr, "ringsim: missing symbol %s\n", name); \
+            exit(2); \
+        } \
+    } while (0)
+#define REG_LOOKUP(type, name) LOOKUP(n->r.name, #name);
+    HAL_REGS(REG_LOOKUP)
+#undef REG_LOOKUP
+    LOOKUP(n->fw_main, "fw_main");
+    LOOKUP(n->timer0_isr, "timer0_isr");
+    LOOKUP(n->uart1_isr, "uart1_isr");
+    LOOKUP(n->adc_isr, "adc_isr");
+    LOOKUP(n->int4_isr, "power_int4_isr");
+    LOOKUP(n->rx_overruns, "rx_overruns");
+    LOOKUP(n->tx_drops, "tx_drops");
+    LOOKUP(n->btn_drops, "btn_drops");
+    /* Not there in a firmware built without WITH_RING_STATS */
+    n->link_rtt = dlsym(n->dl, "linkstat_rtt");
+    n->link_hold = dlsym(n->dl, "linkstat_hold");
+    LOOKUP(n->tick_count, "tick_count");
+    LOOKUP(n->dbuf_show, "dbuf_show");
+
+    int *cfg;
+    LOOKUP(cfg, "cfg");
+    if (opt.sleep)
+        *cfg |= RUN_CFG_SLEEP;
+    if (opt.debug)
+        *cfg |= RUN_CFG_DEBUG;
+
+    void **ctx, **yield, **trace, **ds, **iap, **t0;
+    LOOKUP(ctx, "hal_ctx");
+    LOOKUP(yield, "hal_yield_cb");
+    LOOKUP(trace, "hal_trace_cb");
+    LOOKUP(ds, "hal_ds_cb");
+    LOOKUP(iap, "hal_iap_cb");
+    LOOKUP(t0, "hal_timer0_cb");
+#undef LOOKUP
+    *ctx = n;
+    *yield = (void *)yield_cb;
+    *trace = (void *)trace_cb;
+    *ds = (void *)ds_cb;
+    *iap = (void *)iap_cb;
+    *t0 = (void *)timer0_count_cb;
+
+    n->idx = idx;
+    n->state = -1;
+    *n->r.SBUF = SBUF_IDLE;
+    /* Ports come out of reset high: buttons released, digits off */
+    *n->r.P0 = *n->r.P1 = *n->r.P2 = *n->r.P3 = 0xFF;
+    *n->r.P0_0 = *n->r.P0_1 = 1;
+    *n->r.P1_0 = *n->r.P1_1 = *n->r.P1_2 = *n->r.P1_3 = 1;
+    *n->r.P1_4 = *n->r.P1_5 = *n->r.P1_6 = *n->r.P1_7 = 1;
+    *n->r.P3_0 = *n->r.P3_1 = *n->r.P3_2 = *n->r.P3_3 = 1;
+    *n->r.P3_6 = *n->r.P3_7 = 1;
+
+    n->stack = malloc(FW_STACK_SIZE);
+    getcontext(&n->ctx);
+    n->ctx.uc_stack.ss_sp = n->stack;
+    n->ctx.uc_stack.ss_size = FW_STACK_SIZE;
+    n->ctx.uc_link = NULL;
+    makecontext(&n->ctx, node_entry, 0);
+}
+
+/* --reboot: the firmware starts over with its RAM gone, the board
+ * keeps its RC and the DS1302 on its battery. The old copy stays
+ * loaded until the new one is, the report may still look at it. */
+static void node_power(struct node *n, bool on)
+{
+    if (!on) {
+        if (opt.verbose)
+            printf("%10.3f node %2d power off\n", now / 1e9, n->idx);
+        if (n->idle)
+            n->idle_ns += now - n->sleep_since;
+        if (n->down)
+            n->down_ns += now - n->sleep_since;
+        n->idle = n->down = n->waking = n->int4_pending = false;
+        n->held_until = 0;
+        n->t0_pending = n->adc_pending = false;
+        n->sleep_soon = n->sleep_cancel = n->adc_busy = n->tx_busy = false;
+        n->off = true;
+        n->boot++;
+        if (opt.no_battery)
+            memset(n->ds.ram, 0, sizeof(n->ds.ram));
+        schedule(now + opt.reboot_off_ms * NS_PER_MS, EV_POWER, n, 1);
+        return;
+    }
+    if (opt.verbose)
+        printf("%10.3f node %2d power on\n", now / 1e9, n->idx);
+    void *dl = n->dl, *stack = n->stack;
+    node_load(n, n->idx);
+    dlclose(dl);
+    free(stack);
+    n->off = false;
+    n->awake_at = now;
+    schedule(now, EV_LOOP, n, 0);
+}
+
+static void node_power(struct node *n, bool on);
+
+static void handle(const struct event *ev)
+{
+    struct node *n = ev->n;
+
+    /* The player keeps pressing buttons, whatever the clock does */
+    if (n && ev->boot != n->boot && ev->type != EV_PIN)
+        return;
+
+    switch (ev->type) {
+    case EV_LOOP: {
+        bool timer_was_running = *n->r.TR0;
+        running = n;
+        swapcontext(&sim_ctx, &n->ctx);
+        n->loops++;
+        node_post(n);
+        if (!timer_was_running && *n->r.TR0) {
+            n->timer_gen++;
+            timer0_start(n, now);
+        }
+        /* Interrupts since the last pass stretch the next one. A pass
+         * that set IDL or PD found nothing to do, it sleeps from its
+         * end on */
+        uint64_t isr_ns = isr_ns_total(n);
+        n->sleep_soon = *n->r.PCON & (PCON_IDL | PCON_PD);
+        n->sleep_cancel = false;
+        schedule(now + (n->sleep_soon ? opt.idle_us : opt.loop_us) * 1000 +
+                 isr_ns - n->isr_ns_mark,
+                 n->sleep_soon ? EV_SLEEP : EV_LOOP, n, 0);
+        n->isr_ns_mark = isr_ns;
+        break;
+    }
+
+    case EV_TIMER:
+        if (!*n->r.TR0 || ev->arg != n->timer_gen)
+            break;  // stopped, EV_LOOP restarts us
+        /* The overflow reloads what TL0/TH0 held until now, whatever
+         * the interrupt writes there is for the period after */
+        timer0_start(n, now);
+        if (held(n)) {
+            /* TF0 is set already, this one is gone */
+            if (n->t0_pending)
+                n->held_timer_lost++;
+            n->t0_pending = true;
+        } else if (*n->r.EA && *n->r.ET0) {
+            run_isr(n, n->timer0_isr, &n->timer_isrs, &n->timer_isr_ns,
+                    opt.timer_isr_clk);
+        }
+        break;
+
+    case EV_TX_DONE: {
+        if (ev->arg != n->tx_gen)
+            break;  // overwritten while shifting out
+        struct node *rx = &nodes[(n->idx + 1) % opt.nodes];
+        n->tx_busy = false;
+        if (rx->off) {
+            /* Nobody there */
+        } else if (rx->down || now - byte_time_ns(n) < rx->awake_at) {
+            /* Lost, but its start bit is an edge on INT4 */
+            rx->wake_lost++;
+            if (*rx->r.INT_CLKO & INT_CLKO_EX4) {
+                rx->int4_pending = true;
+                node_wake(rx, now - byte_time_ns(n));
+            }
+        } else if (held(rx) && *rx->r.RI) {
+            /* The ISR did not get to the last byte yet */
+            rx->held_rx_lost++;
+        } else if (*rx->r.REN) {
+            uint8_t b = n->tx_byte;
+            /* A receiver at another rate samples garbage */
+            if (uart_baud(rx) != uart_baud(n))
+                b = (uint8_t)(b * 37 + 11);
+            /* A bad link flips a bit now and then when driven too fast */
+            else if (n->idx == opt.link && uart_baud(n) > opt.link_baud &&
+                     now >= opt.link_from_ms * NS_PER_MS && !(rng() & 3))
+                b ^= 1 << (rng() & 7);
+            *rx->r.SBUF = SBUF_IDLE | b;
+            *rx->r.RI = 1;
+            uart_irq(rx);
+        }
+        *n->r.TI = 1;
+        uart_irq(n);
+        break;
+    }
+
+    case EV_PIN:
+        /* S3 is the move button */
+        if (!ev->arg && game.started &&
+            (n->off || n->state != FW_SM_BTN)) {
+            /* Dark, or back from a reset and not counting yet: the
+             * player waits for the clock before making the move */
+            n->press_lost = true;
+            break;
+        }
+        *n->r.P1_6 = ev->arg;
+        if (!ev->arg) {
+            if (game.started) {
+                n->think_ns = now - game.t_mark;
+                /* The first move starts with the clock, not with a press */
+                if (game.moves)
+                    stat_add(&game.frames_per_move, game.frames - game.frames_mark);
+                game.t_mark = now;
+                game.frames_mark = game.frames;
+                game.t_press = now;
+                game.pressed = n;
+                game.awaiting_start = true;
+                game.moves++;
+            }
+            if (opt.verbose)
+                printf("%10.3f node %2d press S3\n", now / 1e9, n->idx);
+        }
+        break;
+
+    case EV_STALL:
+        if (ev->arg == game.stall_gen && !game.done) {
+            game.stalled = true;
+            game.done = true;
+        }
+        break;
+
+    case EV_ADC: {
+        uint16_t v = adc_sample(*n->r.ADC_CONTR & 7);
+        *n->r.ADC_RES = v >> 2;
+        *n->r.ADC_RESL = v & 3;
+        *n->r.ADC_CONTR = (*n->r.ADC_CONTR & ~ADC_START) | ADC_FLAG;
+        n->adc_busy = false;
+        if (held(n))
+            n->adc_pending = true;
+        else if (*n->r.EA && *n->r.EADC)
+            run_isr(n, n->adc_isr, &n->adc_isrs, &n->adc_isr_ns, opt.adc_isr_clk);
+        break;
+    }
+
+    case EV_RESUME:
+        if (held(n))
+            break;  // more IAP after, a later one resumes
+        if (n->t0_pending && *n->r.TR0 && *n->r.EA && *n->r.ET0)
+            run_isr(n, n->timer0_isr, &n->timer_isrs, &n->timer_isr_ns,
+                    opt.timer_isr_clk);
+        if (n->adc_pending && *n->r.EA && *n->r.EADC)
+            run_isr(n, n->adc_isr, &n->adc_isrs, &n->adc_isr_ns, opt.adc_isr_clk);
+        n->t0_pending = n->adc_pending = false;
+        uart_irq(n);
+        break;
+
+    case EV_SLEEP:
+        /* The firmware looks for work with interrupts off right before
+         * it sleeps: one that came in during the pass is seen then */
+        n->sleep_soon = false;
+        if (n->sleep_cancel) {
+            *n->r.PCON &= ~(PCON_IDL | PCON_PD);
+            schedule(now, EV_LOOP, n, 0);
+            break;
+        }
+        node_sleep(n);
+        n->isr_ns_mark = isr_ns_total(n);
+        break;
+
+    case EV_WKT:
+        if (ev->arg == n->wkt_gen)
+            node_wake(n, now);
+        break;
+
+    case EV_WAKE:
+        n->down = n->waking = false;
+        n->down_ns += now - n->sleep_since;
+        n->awake_at = now;
+        n->wakeups++;
+        n->wkt_gen++;
+        *n->r.PCON &= ~PCON_PD;
+        if (*n->r.TR0) {
+            n->timer_gen++;
+            timer0_start(n, now);
+        }
+        if (n->int4_pending && *n->r.EA && (*n->r.INT_CLKO & INT_CLKO_EX4))
+            run_isr(n, n->int4_isr, &n->uart_isrs, &n->uart_isr_ns, opt.uart_isr_clk);
+        n->int4_pending = false;
+        uart_irq(n);
+        n->isr_ns_mark = isr_ns_total(n);
+        schedule(now, EV_LOOP, n, 0);
+        break;
+
+    case EV_POWER:
+        node_power(n, ev->arg);
+        break;
+
+    case EV_SAMPLE:
+        samples = realloc(samples, (samples_len + 1) * sizeof(*samples));
+        if (!samples) {
+            perror("realloc");
+            exit(1);
+        }
+        for (int i = 0; i < opt.nodes; i++)
+            samples[samples_len][i] = (struct sample){
+                *nodes[i].tick_count, nodes[i].down || nodes[i].off, nodes[i].boot };
+        samples_len++;
+        schedule(now + SAMPLE_S * NS_PER_S, EV_SAMPLE, NULL, 0);
+        break;
+    }
+}
+
+static void report(void)
+{
+    uint64_t overruns = 0, rx_overruns = 0, tx_drops = 0, btn_drops = 0;
+    uint64_t timer_isrs = 0, uart_isrs = 0, loops = 0;
+    uint64_t timer_isr_ns = 0, uart_isr_ns = 0, adc_isr_ns = 0;
+    double duty_min = 100, duty_max = 0;
+    uint64_t display_swaps = 0;
+    uint64_t idle_ns = 0, down_ns = 0, wakeups = 0, wake_lost = 0;
+    uint64_t iap_programs = 0, iap_erases = 0, iap_ns = 0;
+    uint64_t held_timer_lost = 0, held_rx_lost = 0;
+    for (int i = 0; i < opt.nodes; i++) {
+        struct node *n = &nodes[i];
+        /* Close off a sleep still going on */
+        idle_ns += n->idle_ns + (n->idle ? now - n->sleep_since : 0);
+        down_ns += n->down_ns + (n->down ? now - n->sleep_since : 0);
+        wakeups += n->wakeups;
+        wake_lost += n->wake_lost;
+        iap_programs += n->iap_programs;
+        iap_erases += n->iap_erases;
+        iap_ns += n->iap_ns;
+        held_timer_lost += n->held_timer_lost;
+        held_rx_lost += n->held_rx_lost;
+        overruns += nodes[i].tx_overruns;
+        rx_overruns += *nodes[i].rx_overruns;
+        tx_drops += *nodes[i].tx_drops;
+        btn_drops += *nodes[i].btn_drops;
+        timer_isrs += nodes[i].timer_isrs;
+        uart_isrs += nodes[i].uart_isrs;
+        loops += nodes[i].loops;
+        timer_isr_ns += nodes[i].timer_isr_ns;
+        uart_isr_ns += nodes[i].uart_isr_ns;
+        adc_isr_ns += nodes[i].adc_isr_ns;
+        display_swaps += nodes[i].display_swaps;
+        for (int d = 0; d < 4; d++) {
+            double duty = nodes[i].digit_ns[d] * 100.0 / now;
+            if (duty < duty_min)
+                duty_min = duty;
+            if (duty > duty_max)
+                duty_max = duty;
+        }
+    }
+    double secs = now / 1e9 * opt.nodes;
+
+    printf("ring: %d clocks @ %ld baud, %d moves, seed %lu, %.1f s simulated\n",
+           opt.nodes, uart_baud(&nodes[0]), game.moves, opt.seed, now / 1e9);
+    for (int i = 1; i < opt.nodes; i++) {
+        if (uart_baud(&nodes[i]) != uart_baud(&nodes[0])) {
+            printf("rates differ:");
+            for (int j = 0; j < opt.nodes; j++)
+                printf(" %ld", uart_baud(&nodes[j]));
+            printf("\n");
+            break;
+        }
+    }
+    printf("handoff latency   ms  min %8.1f  avg %8.1f  max %8.1f\n",
+           game.latency_ms.min, stat_avg(&game.latency_ms), game.latency_ms.max);
+    printf("frames per move       min %8.0f  avg %8.1f  max %8.0f\n",
+           game.frames_per_move.min, stat_avg(&game.frames_per_move), game.frames_per_move.max);
+    printf("claim round trip  ms  min %8.1f  avg %8.1f  max %8.1f\n",
+           game.claim_rtt_ms.min, stat_avg(&game.claim_rtt_ms), game.claim_rtt_ms.max);
+    /* What the clocks measured themselves, over those that did */
+    double rtt_min = 1e9, rtt_avg = 0, rtt_max = 0, hold_max = 0;
+    int measured = 0;
+    for (int i = 0; i < opt.nodes; i++) {
+        const struct LinkStat *r = nodes[i].link_rtt, *h = nodes[i].link_hold;
+        if (!r)
+            continue;
+        if (r->n) {
+            rtt_min = r->min < rtt_min ? r->min : rtt_min;
+            rtt_avg += r->avg;
+            rtt_max = r->max > rtt_max ? r->max : rtt_max;
+            measured++;
+        }
+        if (h->n && h->max > hold_max)
+            hold_max = h->max;
+    }
+    if (measured) {
+        double ms = 12e3 / FOSC;
+        printf(" .. clocks measured  min %8.1f  avg %8.1f  max %8.1f  held max %.2f\n",
+               rtt_min * ms, rtt_avg / measured * ms, rtt_max * ms, hold_max * ms);
+    }
+    printf("time accounting   ms  avg %8.1f  max|err| %5.0f  total %8.1f\n",
+           stat_avg(&game.error_ms),
+           game.error_ms.n ? (-game.error_ms.min > game.error_ms.max ?
+                              -game.error_ms.min : game.error_ms.max) : 0,
+           game.error_ms.sum);
+    printf("wire: %llu frames, %llu checksum errors, %llu tx overruns\n",
+           (unsigned long long)game.frames, (unsigned long long)game.rx_errors,
+           (unsigned long long)overruns);
+    printf("queues: %llu rx overruns, %llu tx drops, %llu button events dropped\n",
+           (unsigned long long)rx_overruns, (unsigned long long)tx_drops,
+           (unsigned long long)btn_drops);
+    printf("per clock: %.0f timer isr/s, %.1f uart isr/s, %.0f loops/s\n",
+           timer_isrs / secs, uart_isrs / secs, loops / secs);
+    printf("cpu: %.2f%% timer isr, %.2f%% uart isr, %.2f%% adc isr, "
+           "%.2f%% left for the main loop\n",
+           timer_isr_ns / secs / 1e7, uart_isr_ns / secs / 1e7, adc_isr_ns / secs / 1e7,
+           100 - (timer_isr_ns + uart_isr_ns + adc_isr_ns) / secs / 1e7);
+    printf("power: %.1f%% idle, %.1f%% powered down, %.1f wake ups/min, "
+           "%llu bytes lost waking\n",
+           idle_ns / secs / 1e7, down_ns / secs / 1e7, wakeups / secs * 60,
+           (unsigned long long)wake_lost);
+    printf("eeprom: %llu bytes programmed, %llu sectors erased, CPU stopped %.1f ms\n",
+           (unsigned long long)iap_programs, (unsigned long long)iap_erases, iap_ns / 1e6);
+    printf(" .. meanwhile lost %llu timer interrupts, %llu bytes in\n",
+           (unsigned long long)held_timer_lost, (unsigned long long)held_rx_lost);
+    printf("display: digits lit %.2f%% .. %.2f%% of the time, %.1f new pictures/s\n",
+           duty_min, duty_max, display_swaps / secs);
+    /* Over the second half of the run, after calibration settled,
+     * between the first and last samples each clock was awake for */
+    if (samples_len >= 3) {
+        size_t from = samples_len / 2, to = samples_len - 1;
+        double lo = 1e9, hi = -1e9;
+        for (int i = 0; i < opt.nodes; i++) {
+            size_t a = from, b = to;
+            while (a < b && samples[a][i].down)
+                a++;
+            while (b > a && samples[b][i].down)
+                b--;
+            if (a == b || samples[a][i].boot != samples[b][i].boot)
+                continue;
+            double want = (b - a) * SAMPLE_S * 100.0;
+            double ppm = ((uint32_t)(samples[b][i].tick - samples[a][i].tick) / want - 1) * 1e6;
+            if (ppm < lo)
+                lo = ppm;
+            if (ppm > hi)
+                hi = ppm;
+        }
+        if (lo <= hi)
+            printf("tick rate, last %zu s: %+.0f .. %+.0f ppm\n",
+                   (to - from) * SAMPLE_S, lo, hi);
+    }
+    if (game.stalled)
+        printf("STALLED: no clock started within %ld ms\n", opt.stall_ms);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -f, --firmware PATH   firmware library (%s)\n"
+            "  -n, --nodes N         clocks in the ring, 2..%d (%d)\n"
+            "  -b, --baud RATE       force the line rate instead of the programmed one\n"
+            "  -m, --moves N         moves to play (%d)\n"
+            "  -s, --seed N          random seed (%lu)\n"
+            "      --think MIN,MAX   think time per move in ms (%ld,%ld)\n"
+            "      --hold MS         S3 held down this long on a move (%ld)\n"
+            "      --loop-us N       duration of one main loop pass (%ld)\n"
+            "      --idle-us N       .. of one that finds nothing to do (%ld)\n"
+            "      --stall-ms N      give up when a handoff takes longer (%ld)\n"
+            "      --link I,RATE[,MS] TX line of clock I garbles bits above RATE,\n"
+            "                        from MS into the run on\n"
+            "      --rc-ppm N        RC oscillators are off by up to N ppm (%ld)\n"
+            "      --isr-clk T,U[,A] CPU clocks per timer0, uart1 and adc interrupt\n"
+            "                        (%ld,%ld,%ld)\n"
+            "      --light V[,NOISE] LDR reading, 0 bright .. 1023 dark (%ld,%ld)\n"
+            "      --sleep           turn on power down while waiting ('S' menu)\n"
+            "      --debug           turn on debug mode ('D' menu), clocks report links\n"
+            "      --reboot I,MS[,OFF] power clock I off MS into the run, for OFF ms (%ld)\n"
+            "      --no-battery      .. and its DS1302 loses its RAM meanwhile\n"
+            "  -v, --verbose         trace state changes and presses\n",
+            prog, opt.firmware, MAX_NODES, opt.nodes, opt.moves,
+            opt.seed, opt.think_min_ms, opt.think_max_ms, opt.hold_ms, opt.loop_us, opt.idle_us,
+            opt.stall_ms,
+            opt.rc_ppm, opt.timer_isr_clk, opt.uart_isr_clk, opt.adc_isr_clk,
+            opt.light, opt.light_noise, opt.reboot_off_ms);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option longopts[] = {
+        { "firmware", required_argument, NULL, 'f' },
+        { "nodes",    required_argument, NULL, 'n' },
+        { "baud",     required_argument, NULL, 'b' },
+        { "moves",    required_argument, NULL, 'm' },
+        { "seed",     required_argument, NULL, 's' },
+        { "think",    required_argument, NULL, 'T' },
+        { "hold",     required_argument, NULL, 'H' },
+        { "loop-us",  required_argument, NULL, 'L' },
+        { "idle-us",  required_argument, NULL, 'i' },
+        { "stall-ms", required_argument, NULL, 'S' },
+        { "link",     required_argument, NULL, 'l' },
+        { "rc-ppm",   required_argument, NULL, 'R' },
+        { "isr-clk",  required_argument, NULL, 'I' },
+        { "light",    required_argument, NULL, 'D' },
+        { "sleep",    no_argument,       NULL, 'P' },
+        { "debug",    no_argument,       NULL, 'G' },
+        { "reboot",   required_argument, NULL, 'B' },
+        { "no-battery", no_argument,     NULL, 'N' },
+        { "verbose",  no_argument,       NULL, 'v' },
+        { "help",     no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    int c;
+
+    while ((c = getopt_long(argc, argv, "f:n:b:m:s:vh", longopts, NULL)) != -1) {
+        switch (c) {
+        case 'f': opt.firmware = optarg; break;
+        case 'n': opt.nodes = atoi(optarg); break;
+        case 'b': opt.baud = atol(optarg); break;
+        case 'm': opt.moves = atoi(optarg); break;
+        case 's': opt.seed = strtoul(optarg, NULL, 0); break;
+        case 'T':
+            if (sscanf(optarg, "%ld,%ld", &opt.think_min_ms, &opt.think_max_ms) != 2)
+                usage(argv[0]);
+            break;
+        case 'H': opt.hold_ms = atol(optarg); break;
+        case 'L': opt.loop_us = atol(optarg); break;
+        case 'i': opt.idle_us = atol(optarg); break;
+        case 'R': opt.rc_ppm = atol(optarg); break;
+        case 'I':
+            if (sscanf(optarg, "%ld,%ld,%ld", &opt.timer_isr_clk, &opt.uart_isr_clk,
+                       &opt.adc_isr_clk) < 2)
+                usage(argv[0]);
+            break;
+        case 'D':
+            if (sscanf(optarg, "%ld,%ld", &opt.light, &opt.light_noise) < 1)
+                usage(argv[0]);
+            break;
+        case 'P': opt.sleep = true; break;
+        case 'G': opt.debug = true; break;
+        case 'N': opt.no_battery = true; break;
+        case 'B':
+            if (sscanf(optarg, "%d,%ld,%ld", &opt.reboot, &opt.reboot_ms,
+                       &opt.reboot_off_ms) < 2)
+                usage(argv[0]);
+            break;
+        case 'S': opt.stall_ms = atol(optarg); break;
+        case 'l':
+            if (sscanf(optarg, "%d,%ld,%ld", &opt.link, &opt.link_baud,
+                       &opt.link_from_ms) < 2)
+                usage(argv[0]);
+            break;
+        case 'v': opt.verbose = true; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (opt.nodes < 2 || opt.nodes > MAX_NODES || opt.moves < 1 || opt.hold_ms < 1 ||
+        opt.loop_us < 1 || opt.idle_us < 1 || opt.baud < 0 || opt.link >= opt.nodes ||
+        opt.reboot >= opt.nodes)
+        usage(argv[0]);
+
+    rng_state = opt.seed * 0x9E3779B97F4A7C15ULL + 1;
+    for (int i = 0; i < opt.nodes; i++) {
+        struct node *n = &nodes[i];
+        /* Every board its own RC error and RTC phase */
+        if (opt.rc_ppm)
+            n->rc_ppm = rng_range(-opt.rc_ppm, opt.rc_ppm);
+        n->ds.offset_ns = rng() % NS_PER_S;
+        memset(n->eeprom, 0xFF, sizeof(n->eeprom));
+        node_load(n, i);
+        /* Stagger power up a little, like real clocks plugged in one by one */
+        schedule((uint64_t)i * NS_PER_MS, EV_LOOP, n, 0);
+    }
+    if (opt.reboot >= 0)
+        schedule(opt.reboot_ms * NS_PER_MS, EV_POWER, &nodes[opt.reboot], 0);
+
+    /* Clock 0 becomes master by starting the game */
+    schedule_press(&nodes[0], 500 * NS_PER_MS, PRESS_HOLD_MS);
+    stall_watch(opt.stall_ms + 60000);
+    schedule(0, EV_SAMPLE, NULL, 0);
+
+    while (!game.done && heap_len) {
+        struct event ev = pop_event();
+        now = ev.t;
+        handle(&ev);
+    }
+
+    report();
+    return game.stalled ? 1 : 0;
+}
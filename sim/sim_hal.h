@@ -0,0 +1,51 @@
+#ifndef SIM_HAL_H
+#define SIM_HAL_H
+
+/* Host stand-in for the sdcc/STC15 environment.
+ *
+ * Pulled in through stc15.h when building with gcc, so the firmware
+ * sources compile unmodified into firmware.so. The ring simulator
+ * (ringsim.c) loads one copy of that per clock. */
+
+#include <stdint.h>
+#include "hal_regs.h"
+
+/* sdcc keywords */
+#define __bit               uint8_t
+#define __data
+#define __idata
+#define __xdata
+#define __code
+#define __at(_1)
+#define __critical
+#define __interrupt(_1)
+#define __using(_1)
+
+#define HAL_EXTERN(type, name) extern volatile type name;
+HAL_REGS(HAL_EXTERN)
+#undef HAL_EXTERN
+
+/* The simulator runs main() as a coroutine. Every pass of the main loop
+ * kicks the watchdog, which is where we hand control back. */
+void hal_yield(void);
+#define WDT_CLEAR()         hal_yield()
+/* The simulator sees IDL or PD in PCON once we hand back control, and
+ * carries on with us when an interrupt would have woken the chip */
+#define CPU_STOP(mode)      { PCON |= (mode); hal_yield(); }
+
+/* The DS1302 behind ds1302.c (HalDsOp in hal_regs.h) */
+void hal_ds_start(uint8_t cmd);
+void hal_ds_write(uint8_t b);
+uint8_t hal_ds_read(void);
+
+/* The data flash behind eeprom.c: the IAP_* registers hold a command,
+ * this carries it out where the chip sees the trigger sequence */
+void hal_iap(void);
+
+/* Timer0 as it counts: TH0/TL0 only hold the reload here, the live
+ * count is the simulator's to work out */
+uint16_t hal_timer0_count(void);
+
+#define main                fw_main
+
+#endif /* SIM_HAL_H */
@@ -15,36 +15,56 @@
 */
 /*----------------------------------------------------------------------------------*/
 #include "stc15.h"
+#include "hwconfig.h"
 #include "adc.h"
 
+static const uint8_t __code adc_chans[ADC_INPUTS] = { ADC_LIGHT, ADC_TEMP };
+
+uint8_t adc_chan = ADC_LIGHT;
+static uint8_t adc_in;
+
+/* Running average over the last 16 or so samples, times 16: every
+ * sample moves it 1/16 of the way, so it keeps the bits below one
+ * step of the converter too (oversampling) */
+static volatile uint16_t adc_avg[ADC_INPUTS];
+static __bit adc_seeded;
+
 /*----------------------------
 Initial ADC sfr
 ----------------------------*/
-void InitADC(uint8_t chan)
+void adc_init(void)
 {
-	P1ASF |= 1 << chan;             //enable channel ADC function
+	P1ASF = 1 << ADC_LIGHT | 1 << ADC_TEMP;   //enable channel ADC function
 	ADC_RES = 0;                    //Clear previous result
 	ADC_CONTR = ADC_POWER | ADC_SPEEDLL;
-	//Delay(2);                       //ADC power-on and delay
+	EADC = 1;                       //first conversion with the next frame
 }
 
 /*----------------------------
-Get ADC result - 10 bit
+ADC complete: take the result, move on to the next channel
 ----------------------------*/
-uint16_t getADCResult(uint8_t chan)
+void adc_isr(void) __interrupt(5) __using(3)
 {
-	uint8_t upper8;
-	upper8 = getADCResult8(chan);
-	return  upper8 << 2 | (ADC_RESL & 0b11) ;  //Return ADC result, 10 bits
+	uint16_t sample;
+
+	ADC_CONTR = ADC_POWER | ADC_SPEEDLL;      //Clear ADC_FLAG
+	sample = ADC_RES << 2 | (ADC_RESL & 0b11);  //10 bits
+	if (adc_seeded)
+		adc_avg[adc_in] += sample - (adc_avg[adc_in] >> 4);
+	else
+		adc_avg[adc_in] = sample << 4;
+	if (++adc_in == ADC_INPUTS) {
+		adc_in = 0;
+		adc_seeded = 1;
+	}
+	adc_chan = adc_chans[adc_in];
 }
 
-uint8_t getADCResult8(uint8_t chan)
+uint16_t adc_read(uint8_t in)
 {
-	ADC_CONTR = ADC_POWER | ADC_SPEEDHH | ADC_START | chan;
-	_nop_;       //Must wait before inquiry
-	while (!(ADC_CONTR & ADC_FLAG));  //Wait complete flag
-	ADC_CONTR &= ~ADC_FLAG;           //Close ADC
-	return  ADC_RES;  //Return ADC result, 8 bits
+	uint16_t v;
+	__critical {
+		v = adc_avg[in];
+	}
+	return v >> 4;
 }
-
-
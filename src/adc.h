@@ -14,9 +14,10 @@
 /* article, please specify in which data and procedures from STC    ---
 */
 /*----------------------------------------------------------------------------------*/
-#include <stdint.h>
+#ifndef ADC_H
+#define ADC_H
 
-#define _nop_ __asm nop __endasm;
+#include <stdint.h>
 
 /*Define ADC operation const for ADC_CONTR*/
 #define ADC_POWER   0x80            //ADC power control bit
@@ -27,20 +28,27 @@
 #define ADC_SPEEDH  0x40            //180 clocks
 #define ADC_SPEEDHH 0x60            //90 clocks
 
-/*----------------------------
-Initialize ADC sfr
-----------------------------*/
-void InitADC(uint8_t chan);
+/* The channels sampled round robin, see hwconfig.h */
+enum AdcInput {
+    ADC_IN_LIGHT,
+    ADC_IN_TEMP,
+    ADC_INPUTS
+};
+
+/* Conversions are started from the timer0 interrupt, once per display
+ * frame (125 Hz), and picked up by adc_isr(). Nothing waits on them. */
+extern uint8_t adc_chan;
+#define ADC_KICK()  (ADC_CONTR = ADC_POWER | ADC_SPEEDLL | ADC_START | adc_chan)
 
 /*----------------------------
-Get ADC result - 10 bits
+Initialize ADC sfr, enable the interrupt
 ----------------------------*/
-uint16_t getADCResult(uint8_t chan);
+void adc_init(void);
+void adc_isr(void) __interrupt(5) __using(3);
 
 /*----------------------------
-Get ADC result - 8 bits
+Running average of an input, 10 bits
 ----------------------------*/
-uint8_t getADCResult8(uint8_t chan);
-
-
+uint16_t adc_read(uint8_t in);
 
+#endif /* ADC_H */
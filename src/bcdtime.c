@@ -0,0 +1,88 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include "stc15.h"
+#include "timer0.h"
+#include "bcdtime.h"
+
+/* Further than this it is quicker to convert */
+#define BCD_STEPS_MAX   16
+
+/* 0..99 to BCD, by subtraction */
+uint8_t bcd(uint8_t val)
+{
+    uint8_t ten = 0;
+    while(val >= 10) {
+        val -= 10;
+        ten += 0x10;
+    }
+    return ten | val;
+}
+
+/* Takes a few rounds of subtraction, only needed when a time jumps */
+void bcd_set(struct BcdTime *t, uint32_t ticks)
+{
+    uint8_t min = 0;
+
+    t->ticks = ticks;
+    while(ticks >= 60 * TMO_SECOND) {
+        ticks -= 60 * TMO_SECOND;
+        if(++min == 100) {
+            t->min = 0x99; t->sec = 0x59; t->cs = 0x99;
+            return;
+        }
+    }
+    t->min = bcd(min);
+    min = 0;    // now seconds
+    while(ticks >= TMO_SECOND) {
+        ticks -= TMO_SECOND;
+        min++;
+    }
+    t->sec = bcd(min);
+    t->cs = bcd(ticks);
+}
+
+/* One BCD byte one down/up, wrapping between 0 and top.
+ * Returns true on the wrap, that is a borrow/carry. */
+static bool bcd_dec(uint8_t *v, uint8_t top)
+{
+    if(*v == 0) {
+        *v = top;
+        return true;
+    }
+    *v -= (*v & 0x0F) ? 1 : 0x10 - 9;
+    return false;
+}
+
+static bool bcd_inc(uint8_t *v, uint8_t top)
+{
+    if(*v == top) {
+        *v = 0;
+        return true;
+    }
+    *v += (*v & 0x0F) == 9 ? 0x10 - 9 : 1;
+    return false;
+}
+
+/* Whatever is shown moves a tick or so between calls, so we follow it
+ * in BCD a tick at a time. 99:59.99 stands for anything longer as
+ * well, steps from there would be wrong: in the last minute it
+ * converts. */
+void bcd_follow(struct BcdTime *t, uint32_t ticks)
+{
+    uint32_t down = t->ticks - ticks;
+
+    if(t->min == 0x99) {
+        bcd_set(t, ticks);
+    } else if(down < BCD_STEPS_MAX) {
+        for(; down; down--)
+            if(bcd_dec(&t->cs, 0x99) && bcd_dec(&t->sec, 0x59))
+                bcd_dec(&t->min, 0x99);
+    } else if(-down < BCD_STEPS_MAX) {
+        for(; down; down++)
+            if(bcd_inc(&t->cs, 0x99) && bcd_inc(&t->sec, 0x59))
+                bcd_inc(&t->min, 0x99);
+    } else {
+        bcd_set(t, ticks);
+    }
+    t->ticks = ticks;
+}
@@ -0,0 +1,24 @@
+#ifndef BCDTIME_H
+#define BCDTIME_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Times on the display are kept in BCD, so the digits are nibbles
+ * and showing them takes no division: sdcc would pull in its 16 and
+ * 32 bit division routines for that. */
+struct BcdTime {
+    uint8_t min;
+    uint8_t sec;
+    uint8_t cs;         // hundredths, one per tick
+    uint32_t ticks;     // what it shows, all 0 is 0:00.00
+};
+
+//0..99 to BCD
+uint8_t bcd(uint8_t val);
+//Show ticks, 99:59.99 at most
+void bcd_set(struct BcdTime *t, uint32_t ticks);
+//Same, by BCD steps when it only moved a few ticks since the last time
+void bcd_follow(struct BcdTime *t, uint32_t ticks);
+
+#endif /* BCDTIME_H */
@@ -4,16 +4,24 @@
 #include "hwconfig.h"
 #include "timer0.h"
 
-static uint8_t beep_timer = 1 * TMO_100MS;
+static deadline_t beep_end = 1 * TMO_100MS;
+static __bit beep_new;
 
 void beep_start(uint8_t tmo)
 {
-    set_timer(&beep_timer, tmo);
+    deadline_set(&beep_end, tmo);
+    beep_new = 1;
+}
+
+bool beep_pending(void)
+{
+    return beep_new;
 }
 
 void beep_handle(bool enabled)
 {
-    if (timer_elapsed(&beep_timer)) {
+    beep_new = 0;
+    if (deadline_passed(beep_end)) {
         BUZZER_OFF;
     } else {
         if(enabled) {
@@ -1,6 +1,11 @@
 #ifndef BEEP_H
 #define BEEP_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 void beep_start(uint8_t tmo);
+//True from beep_start() until the next beep_handle()
+bool beep_pending(void);
 void beep_handle(bool enabled);
 #endif
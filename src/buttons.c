@@ -26,7 +26,7 @@ static volatile __bit S3_PRESSED;
     } else {
         if (S1_PRESSED) {
             if (!S1_LONG) {
-                ev = EV_S1_SHORT;
+                btn_push(EV_S1_SHORT, ticks_now());
             }
             S1_PRESSED = 0;
             S1_LONG = 0;
@@ -36,30 +36,116 @@ static volatile __bit S3_PRESSED;
     if (switchcount[s] > SW_CNTMAX) {
         S1_LONG = 1;
         switchcount[s] = 0;
-        ev = EV_S1_LONG;
+        btn_push(EV_S1_LONG, ticks_now());
     }
 }
 */
 
 
-/* This stores the last event.
- * After reading this should be set to EV_NONE,
- * new events will not be processed until it is set to EV_NONE */
-enum ButtonEvent event;
+volatile __bit s3_down;
+volatile __bit s3_press;
+volatile uint16_t s3_tick;
+volatile uint16_t s3_counts;
+uint8_t s3_count;
+static uint16_t press_counts;
+static __bit s3_used;
+
+/* Events wait in a ring until the state machine gets to them, same as
+ * received frames do in uart.c: buttons_read() only moves btn_head,
+ * buttons_event() only btn_tail. Of the tick only the low 16 bits are
+ * kept, 655 seconds is plenty. */
+#ifndef BTN_QUEUE_LEN
+#define BTN_QUEUE_LEN 4 // power of 2
+#endif
+static __idata uint8_t btn_ev[BTN_QUEUE_LEN];
+static __idata uint16_t btn_tick[BTN_QUEUE_LEN];
+static volatile uint8_t btn_head;
+static volatile uint8_t btn_tail;
+volatile uint8_t btn_drops;
+
+static uint8_t switchcount[NUM_SW];
+
+static void btn_push(uint8_t ev, uint16_t tick)
+{
+    uint8_t i;
+
+    /* S1 and S2 held long together is one event of its own */
+    if (ev == EV_S1_LONG && S2_PRESSED) {
+        S2_LONG = 1;
+        switchcount[1] = 0;
+        ev = EV_S1S2_LONG;
+    } else if (ev == EV_S2_LONG && S1_PRESSED) {
+        S1_LONG = 1;
+        switchcount[0] = 0;
+        ev = EV_S1S2_LONG;
+    }
+
+    if ((uint8_t)(btn_head - btn_tail) == BTN_QUEUE_LEN) {
+        btn_drops++;
+        return;
+    }
+    i = btn_head & (BTN_QUEUE_LEN - 1);
+    btn_ev[i] = ev;
+    btn_tick[i] = tick;
+    btn_head++;
+}
+
+bool buttons_pending(void)
+{
+    return btn_tail != btn_head;
+}
+
+uint8_t buttons_arrivals(void)
+{
+    return btn_head;
+}
+
+uint16_t buttons_press_age(void)
+{
+    return timer0_counts() - press_counts;
+}
+
+void buttons_s3_used(void)
+{
+    s3_used = 1;
+}
+
+enum ButtonEvent buttons_event(uint32_t *tick)
+{
+    uint8_t i;
+    uint32_t now;
+
+    if (btn_tail == btn_head)
+        return EV_NONE;
+    i = btn_tail & (BTN_QUEUE_LEN - 1);
+    now = ticks_now();
+    *tick = now - (uint16_t)((uint16_t)now - btn_tick[i]);
+    btn_tail++;
+    return btn_ev[i];
+}
 
 void buttons_read(void)
 {
     static uint8_t debounce[NUM_SW];      // switch debounce buffer
-    static uint8_t switchcount[NUM_SW];
 #define SW_CNTMAX (80*1)	//long push
 
+    /* The fast path, every pass */
+    if (s3_press) {
+        uint16_t tick;
+        __critical {
+            tick = s3_tick;
+            press_counts = s3_counts;
+            s3_press = 0;
+        }
+        btn_push(EV_S3_PRESS, tick);
+    }
+
     static uint8_t t = 0;
     /* Run only every 10ms */
     if(t != (time_now & TICK_10MS))
         return;
     t ^= 1;
 
-    enum Event ev = EV_NONE;
     // Check SW status and chattering control
 #define MONITOR_S(n) \
     { \
@@ -76,7 +162,7 @@ void buttons_read(void)
             /* released or bounced */ \
             if (S ## n ## _PRESSED) { \
                 if (!S ## n ## _LONG) { \
-                    ev = EV_S ## n ## _SHORT; \
+                    btn_push(EV_S ## n ## _SHORT, ticks_now()); \
                 } \
                 S ## n ## _PRESSED = 0; \
                 S ## n ## _LONG = 0; \
@@ -86,7 +172,7 @@ void buttons_read(void)
         if (switchcount[s] > SW_CNTMAX) { \
             S ## n ## _LONG = 1; \
             switchcount[s] = 0; \
-            ev = EV_S ## n ## _LONG; \
+            btn_push(EV_S ## n ## _LONG, ticks_now()); \
         } \
     }
 
@@ -94,17 +180,16 @@ void buttons_read(void)
     MONITOR_S(2);
     MONITOR_S(3);
 
-    if (ev == EV_S1_LONG && S2_PRESSED) {
-        S2_LONG = 1;
-        switchcount[1] = 0;
-        ev = EV_S1S2_LONG;
-    } else if (ev == EV_S2_LONG && S1_PRESSED) {
-        S1_LONG = 1;
-        switchcount[0] = 0;
-        ev = EV_S1S2_LONG;
-    }
-    if (event == EV_NONE) {
-        event = ev;
+    /* Held on after the move, S3 would go on to the recovery of
+     * EV_S3_LONG. Keep S3_LONG set, as if that was posted already,
+     * until both paths saw it go up. */
+    if (s3_used) {
+        if (!s3_down && !S3_PRESSED) {
+            s3_used = 0;
+            S3_LONG = 0;
+        } else {
+            S3_LONG = 1;
+        }
     }
 }
 
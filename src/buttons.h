@@ -1,6 +1,9 @@
 #ifndef BUTTONS_H
 #define BUTTONS_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 enum ButtonEvent {
     EV_NONE,
     EV_S1_SHORT,
@@ -11,10 +14,56 @@ enum ButtonEvent {
     EV_S3_SHORT,
     EV_S3_LONG,
     EV_TIMEOUT,
+    EV_S3_PRESS,    // S3 went down, through the fast path below
 };
 
-extern enum ButtonEvent event;
-
+/* Samples the buttons every 10ms and queues what they did */
 void buttons_read(void);
 
+/* Oldest event not handled yet, EV_NONE when there is none.
+ * tick is when it happened. */
+enum ButtonEvent buttons_event(uint32_t *tick);
+//True while events wait in the queue
+bool buttons_pending(void);
+//Events queued so far, wraps
+uint8_t buttons_arrivals(void);
+
+/* Events lost because the queue was full */
+extern volatile uint8_t btn_drops;
+
+/* Fast path for the move button, sampled by the timer0 interrupt twice
+ * a slot (1000/s). Low for S3_PRESS_SAMPLES in a row is a press, which
+ * is queued as EV_S3_PRESS with the tick it happened in on the next
+ * buttons_read(). The bounce goes into the release: it takes
+ * S3_RELEASE_SAMPLES high in a row before another press counts. S3
+ * still gives its EV_S3_SHORT/LONG too. */
+#define S3_PRESS_SAMPLES    2   // ~1 ms
+#define S3_RELEASE_SAMPLES  20  // ~20 ms
+
+extern volatile __bit s3_down;
+extern volatile __bit s3_press;
+extern volatile uint16_t s3_tick;
+extern volatile uint16_t s3_counts;
+extern uint8_t s3_count;
+
+//Counts of timer0_counts() since the last EV_S3_PRESS, to within a sample
+uint16_t buttons_press_age(void);
+//The last EV_S3_PRESS made a move: that press gives no EV_S3_SHORT/LONG
+void buttons_s3_used(void);
+
+#define BUTTONS_SAMPLE_S3(counts) { \
+        if ((!SW3) != s3_down) { \
+            if (++s3_count == (s3_down ? S3_RELEASE_SAMPLES : S3_PRESS_SAMPLES)) { \
+                s3_count = 0; \
+                s3_down = !s3_down; \
+                if (s3_down) { \
+                    s3_tick = (uint16_t)tick_count; \
+                    s3_counts = (counts); \
+                    s3_press = 1; \
+                } \
+            } \
+        } else { \
+            s3_count = 0; \
+        } }
+
 #endif /* BUTTONS_H */
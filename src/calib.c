@@ -0,0 +1,110 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include "stc15.h"
+#include "timer0.h"
+#include "ds1302.h"
+#include "calib.h"
+
+/* The internal RC oscillator is off by up to a percent or so, the
+ * DS1302 runs off a 32.768 kHz crystal. Count timer0 slots between
+ * edges of its seconds register and set the tick rate from that.
+ *
+ * An edge is seen up to a main loop pass late, at the start and at the
+ * end of the measurement, so the longer it runs the better. The first
+ * estimate is used after CAL_FIRST seconds, then after every doubling
+ * up to CAL_LAST seconds. Each result goes into DS1302 RAM and is used
+ * from power up on. */
+#define CAL_FIRST   64
+#define CAL_LAST    1024
+
+/* Anything further off than this is not the RC, something is broken */
+#define CAL_MIN_SLOTS(s)  ((s) * (TIMER0_HZ * 97UL / 100))
+#define CAL_MAX_SLOTS(s)  ((s) * (TIMER0_HZ * 103UL / 100))
+
+static uint8_t last_sec;
+static uint16_t last_count;
+static uint32_t cal_slots;      // timer0 slots counted over ..
+static uint16_t cal_secs;       // .. this many DS1302 seconds
+static uint16_t cal_next;       // next time to use the result, 0 = stop
+static __bit cal_started;
+static __bit cal_valid;
+
+/* Stored as timer0 slots per CAL_LAST seconds, secs is
+ * a power of 2 up to that */
+static void cal_store(uint32_t slots, uint16_t secs)
+{
+    uint8_t addr = DS_CMD_RAM >> 1 | DS_RAM_TICK_CAL;
+
+    for (; secs != CAL_LAST; secs <<= 1)
+        slots <<= 1;
+    for (uint8_t i = 0; i != 4; i++) {
+        ds_writebyte(addr++, slots);
+        slots >>= 8;
+    }
+}
+
+void calib_init(void)
+{
+    uint8_t addr = DS_CMD_RAM >> 1 | (DS_RAM_TICK_CAL + 3);
+    uint32_t slots = 0;
+
+    ds_init();
+    for (uint8_t i = 0; i != 4; i++) {
+        slots = slots << 8 | ds_readbyte(addr--);
+    }
+    if (slots >= CAL_MIN_SLOTS(CAL_LAST) && slots <= CAL_MAX_SLOTS(CAL_LAST)) {
+        timer0_set_rate(CAL_LAST * TMO_SECOND, slots);
+        cal_valid = 1;
+    }
+    calib_restart();
+}
+
+void calib_restart(void)
+{
+    cal_started = 0;
+    cal_slots = 0;
+    cal_secs = 0;
+    cal_next = CAL_FIRST;
+    last_sec = ds_readbyte(DS_ADDR_SECONDS);
+}
+
+bool calib_done(void)
+{
+    return cal_valid;
+}
+
+void calib_poll(void)
+{
+    uint8_t sec;
+    uint16_t count;
+
+    if (!cal_next)
+        return;
+
+    count = timer0_slots();
+    sec = ds_readbyte(DS_ADDR_SECONDS);
+    if (sec == last_sec)
+        return;
+    last_sec = sec;
+
+    /* Measure from the first edge on */
+    if (cal_started) {
+        cal_slots += (uint16_t)(count - last_count);
+        cal_secs++;
+    }
+    cal_started = 1;
+    last_count = count;
+
+    if (cal_secs == cal_next) {
+        uint32_t ticks = (uint32_t)cal_secs * TMO_SECOND;
+        if (cal_slots >= CAL_MIN_SLOTS(cal_secs) && cal_slots <= CAL_MAX_SLOTS(cal_secs)) {
+            timer0_set_rate(ticks, cal_slots);
+            cal_store(cal_slots, cal_secs);
+            cal_valid = 1;
+        }
+        if (cal_next < CAL_LAST)
+            cal_next <<= 1;
+        else
+            cal_next = 0;
+    }
+}
@@ -0,0 +1,13 @@
+#ifndef CALIB_H
+#define CALIB_H
+
+#include <stdbool.h>
+
+/* Tick calibration against the DS1302 crystal */
+void calib_init(void);
+void calib_poll(void);
+void calib_restart(void);
+//True once the tick runs on a measured rate
+bool calib_done(void);
+
+#endif /* CALIB_H */
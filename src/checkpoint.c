@@ -0,0 +1,85 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include "stc15.h"
+#include "ds1302.h"
+#include "util.h"
+#include "checkpoint.h"
+
+/* The checkpoint goes out in one burst at every handoff: a single
+ * command byte and CE cycle, where byte by byte writes take one of
+ * each per byte. It is stamped with the DS1302 time, on resume the
+ * seconds since are charged to whoever had the move. */
+#define CKPT_SEED       0xA5    // RAM of all 0 or all 1 does not check out
+
+static __idata uint8_t buf[CKPT_LEN];
+
+static uint8_t __idata *put24(uint8_t __idata *p, uint32_t v)
+{
+    *p++ = v >> 16;
+    *p++ = v >> 8;
+    *p++ = v;
+    return p;
+}
+
+static uint32_t get24(const uint8_t __idata *p)
+{
+    return (uint32_t)p[0] << 16 | (uint16_t)p[1] << 8 | p[2];
+}
+
+static uint8_t ckpt_sum(void)
+{
+    uint8_t sum = CKPT_SEED;
+    for (uint8_t i = 1; i != CKPT_LEN; i++)
+        sum += buf[i];
+    return sum;
+}
+
+void ckpt_save(const struct Checkpoint *c)
+{
+    uint8_t __idata *p = buf + 1;
+
+    *p++ = c->id;
+    *p++ = c->nr_of_players;
+    *p++ = c->active_player_id;
+    *p++ = c->cfg;
+    *p++ = c->baud;
+    *p++ = c->move;
+    p = put24(p, ds_daytime());
+    p = put24(p, c->time_left);
+    for (uint8_t i = 0; i != CKPT_PLAYERS; i++)
+        p = put24(p, c->remaining_time[i]);
+    buf[0] = ckpt_sum();
+    ds_burst_write(DS_CMD_RAM, buf, CKPT_LEN);
+}
+
+uint16_t ckpt_load(struct Checkpoint *c)
+{
+    uint32_t stamp, now;
+
+    ds_burst_read(DS_CMD_RAM, buf, CKPT_LEN);
+    if (buf[0] != ckpt_sum() || buf[1] >= buf[2])
+        return CKPT_NONE;
+
+    c->id = buf[1];
+    c->nr_of_players = buf[2];
+    c->active_player_id = buf[3];
+    c->cfg = buf[4];
+    c->baud = buf[5];
+    c->move = buf[6];
+    stamp = get24(buf + 7);
+    c->time_left = get24(buf + 10);
+    for (uint8_t i = 0; i != CKPT_PLAYERS; i++)
+        c->remaining_time[i] = get24(buf + 13 + 3 * i);
+
+    now = ds_daytime();
+    if (now < stamp)
+        now += DAY_SECONDS;
+    now -= stamp;
+    return now > CKPT_MAX_AGE ? CKPT_NONE : now;
+}
+
+void ckpt_clear(void)
+{
+    /* No players: id is never below that, and the sum is off */
+    ds_writebyte(DS_CMD_RAM >> 1 | (DS_RAM_CKPT + 2), 0);
+}
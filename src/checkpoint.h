@@ -0,0 +1,39 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Where the game stood at the last handoff, kept in DS1302 RAM so a
+ * clock that was reset picks the game up again by itself. Only the
+ * players a real ring has get their time kept, a bigger one (host
+ * build) restores the others as unknown. */
+#define CKPT_PLAYERS    4
+
+struct Checkpoint {
+    uint8_t id;
+    uint8_t nr_of_players;
+    uint8_t active_player_id;   // holds the move
+    uint8_t cfg;
+    uint8_t baud;               // line rate index, see uart1_baud_index()
+    uint8_t move;               // number of the move, see main.c
+    uint32_t time_left;
+    uint32_t remaining_time[CKPT_PLAYERS];
+};
+
+/* Times are 24 bits, like on the wire: check, 6 bytes, stamp,
+ * time_left and the others */
+#define CKPT_LEN        (1 + 6 + 3 + 3 + 3 * CKPT_PLAYERS)
+
+/* No move takes longer than a game, anything older is a game
+ * that was put away */
+#define CKPT_MAX_AGE    (90 * 60)
+#define CKPT_NONE       0xFFFF
+
+void ckpt_save(const struct Checkpoint *c);
+//Seconds since it was saved, CKPT_NONE if there is nothing to resume
+uint16_t ckpt_load(struct Checkpoint *c);
+//New game, nothing to go back to
+void ckpt_clear(void);
+
+#endif /* CHECKPOINT_H */
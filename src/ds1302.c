@@ -2,10 +2,12 @@
 // http://datasheets.maximintegrated.com/en/ds/DS1302.pdf
 //
 
+#ifndef __GNUC__
 #pragma callee_saves sendbyte,readbyte
 #pragma callee_saves ds_writebyte,ds_readbyte
 // silence: "src/ds1302.c:84: warning 59: function 'readbyte' must return value"
 #pragma disable_warning 59
+#endif
 
 #include "ds1302.h"
 
@@ -14,6 +16,7 @@
 
 #define INCR(num, low, high) if (num < high) { num++; } else { num = low; }
 
+#ifdef WITH_DS_CLOCK_UI
 /*
   Judge whether need to initialize RAM or not by checking RAM address 0x10-0x11 has A5,5A (MAGIC).
   When MAGIC key is found, initialize. Other case, read out the data.
@@ -59,7 +62,14 @@ void ds_ram_config_write() {
         j++;
     }
 }
-
+#endif /* WITH_DS_CLOCK_UI */
+
+#ifdef __GNUC__
+/* Host build: the ring simulator plays the DS1302 a byte at a time */
+#define ds_start(cmd)   hal_ds_start(cmd)
+#define sendbyte(b)     hal_ds_write(b)
+#define readbyte()      hal_ds_read()
+#else
 void sendbyte(uint8_t b)
 {
     b;
@@ -102,46 +112,29 @@ uint8_t readbyte()
   __endasm;
 }
 
-uint8_t ds_readbyte(uint8_t addr) {
-    // ds1302 single-byte read
-    uint8_t b;
-    b = DS_CMD | DS_CMD_CLOCK | addr << 1 | DS_CMD_READ;
+// raise CE and send the command byte
+static void ds_start(uint8_t cmd)
+{
     DS_CE = 0;
     DS_SCLK = 0;
     DS_CE = 1;
-    // send cmd byte
-    sendbyte(b);
+    sendbyte(cmd);
+}
+#endif /* __GNUC__ */
+
+uint8_t ds_readbyte(uint8_t addr) {
+    // ds1302 single-byte read
+    uint8_t b;
+    ds_start(DS_CMD | DS_CMD_CLOCK | addr << 1 | DS_CMD_READ);
     // read byte
     b = readbyte();
     DS_CE = 0;
     return b;
 }
 
-void ds_readburst() {
-    // ds1302 burst-read 8 bytes into struct
-    uint8_t j, b;
-    b = DS_CMD | DS_CMD_CLOCK | DS_BURST_MODE << 1 | DS_CMD_READ;
-    DS_CE = 0;
-    DS_SCLK = 0;
-    DS_CE = 1;
-    // send cmd byte
-    sendbyte(b);
-    // read bytes
-    for (j = 0; j != 8; j++) {
-        rtc_table[j] = readbyte();
-    }
-    DS_CE = 0;
-}
-
 void ds_writebyte(uint8_t addr, uint8_t data) {
     // ds1302 single-byte write
-    uint8_t b = 0;
-    b = DS_CMD | DS_CMD_CLOCK | addr << 1 | DS_CMD_WRITE;
-    DS_CE = 0;
-    DS_SCLK = 0;
-    DS_CE = 1;
-    // send cmd byte
-    sendbyte(b);
+    ds_start(DS_CMD | DS_CMD_CLOCK | addr << 1 | DS_CMD_WRITE);
     // send data byte
     sendbyte(data);
 
@@ -162,6 +155,52 @@ void ds_init() {
     ds_writebyte(DS_ADDR_SECONDS, b); // clear CH
 }
 
+void ds_burst_read(uint8_t space, uint8_t *buf, uint8_t len) {
+    ds_start(DS_CMD | space | DS_BURST_MODE << 1 | DS_CMD_READ);
+    for (; len; len--)
+        *buf++ = readbyte();
+    DS_CE = 0;
+}
+
+/*
+  One command byte for the lot instead of one per byte, and nothing
+  sees the registers half written
+ */
+void ds_burst_write(uint8_t space, const uint8_t *buf, uint8_t len) {
+    ds_start(DS_CMD | space | DS_BURST_MODE << 1 | DS_CMD_WRITE);
+    for (; len; len--)
+        sendbyte(*buf++);
+    DS_CE = 0;
+}
+
+static uint8_t bcd_bin(uint8_t b) {
+    return (b >> 4) * 10 + (b & 0x0F);
+}
+
+// The DS1302 may run 12 or 24 hours
+uint32_t ds_daytime(void) {
+    uint8_t t[3], hours;
+
+    ds_burst_read(DS_CMD_CLOCK, t, 3);
+    if (t[DS_ADDR_HOUR] & DS_MASK_1224_MODE) {
+        hours = bcd_bin(t[DS_ADDR_HOUR] & DS_MASK_HOUR12);
+        if (hours == 12)
+            hours = 0;
+        if (t[DS_ADDR_HOUR] & DS_MASK_PM)
+            hours += 12;
+    } else {
+        hours = bcd_bin(t[DS_ADDR_HOUR] & DS_MASK_HOUR24);
+    }
+    return ((uint32_t)hours * 60 + bcd_bin(t[DS_ADDR_MINUTES] & DS_MASK_MINUTES)) * 60 +
+           bcd_bin(t[DS_ADDR_SECONDS] & DS_MASK_SECONDS);
+}
+
+#ifdef WITH_DS_CLOCK_UI
+void ds_readburst() {
+    // ds1302 burst-read 8 bytes into struct
+    ds_burst_read(DS_CMD_CLOCK, rtc_table, 8);
+}
+
 /*
 // reset date, time
 void ds_reset_clock() {
@@ -344,3 +383,4 @@ uint8_t ds_int2bcd_tens(uint8_t integer) {
 uint8_t ds_int2bcd_ones(uint8_t integer) {
     return integer % 10;
 }
+#endif /* WITH_DS_CLOCK_UI */
@@ -2,6 +2,9 @@
 // http://datasheets.maximintegrated.com/en/ds/DS1302.pdf
 //
 
+#ifndef DS1302_H
+#define DS1302_H
+
 #include "stc15.h"
 #include <stdint.h>
 #include "hwconfig.h"
@@ -68,6 +71,38 @@
 #define DS_MASK_YEAR_TENS     0b11110000
 #define DS_MASK_YEAR_UNITS    0b00001111
 
+// RAM bytes (0..30), used through ds_readbyte(DS_CMD_RAM >> 1 | addr).
+// A burst always starts at byte 0, so the checkpoint comes first.
+#ifdef WITH_DS_CLOCK_UI
+#define DS_RAM_MAGIC        0   // 2 bytes
+#define DS_RAM_CFG          2   // 4 bytes, cfg_table
+#else
+#define DS_RAM_CKPT         0   // CKPT_LEN bytes, checkpoint.c
+#endif
+#define DS_RAM_TICK_CAL     27  // 4 bytes, calib.c
+
+// DS1302 Functions
+
+// ds1302 single-byte read
+uint8_t ds_readbyte(uint8_t addr);
+
+// ds1302 single-byte write
+void ds_writebyte(uint8_t addr, uint8_t data);
+
+// clear WP, CH
+void ds_init();
+
+// ds1302 burst transfer from address 0 on, space is DS_CMD_CLOCK or
+// DS_CMD_RAM. A clock write only takes when all 8 registers are sent.
+void ds_burst_read(uint8_t space, uint8_t *buf, uint8_t len);
+void ds_burst_write(uint8_t space, const uint8_t *buf, uint8_t len);
+
+// seconds into the day, from one burst so they belong together
+uint32_t ds_daytime(void);
+
+/* The clock, alarm and chime settings of the original clock firmware.
+ * The chess clock only uses the DS1302 as a reference and for storage. */
+#ifdef WITH_DS_CLOCK_UI
 /* 
   NB: the rtc and config bits below were originally structs/unions, but for some reason 
   the resulting code was bloated coming out of sdcc. This is attempt to recreate this
@@ -121,23 +156,12 @@ __bit __at (0x61) CONF_ALARM_ON;
 __bit __at (0x62) CONF_CHIME_ON;
 __bit __at (0x6E) CONF_SW_MMDD;
 
-// DS1302 Functions
-
 void ds_ram_config_init();
 void ds_ram_config_write();
 
-// ds1302 single-byte read
-uint8_t ds_readbyte(uint8_t addr);
-
 // ds1302 burst-read 8 bytes into struct
 void ds_readburst();
 
-// ds1302 single-byte write
-void ds_writebyte(uint8_t addr, uint8_t data);
-
-// clear WP, CH
-void ds_init();
-
 // reset date/time to 01/01 00:00
 //void ds_reset_clock();
 
@@ -181,3 +205,6 @@ void ds_chime_on_toggle();
 void ds_date_mmdd_toggle();
 void ds_temperature_offset_incr();
 void ds_temperature_cf_toggle();
+#endif /* WITH_DS_CLOCK_UI */
+
+#endif /* DS1302_H */
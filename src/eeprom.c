@@ -0,0 +1,73 @@
+// On-chip data flash (EEPROM) through IAP
+//
+
+#include <stdint.h>
+#include "stc15.h"
+#include "hwconfig.h"
+#include "timer0.h"
+#include "eeprom.h"
+
+#ifdef WITH_JOURNAL
+
+#ifdef __GNUC__
+/* Host build: the ring simulator plays the flash, see hal_iap() */
+#define IAP_TRIGGER()   hal_iap()
+#else
+#define IAP_TRIGGER() { \
+        IAP_TRIG = 0x5a;        /*Send trigger command1 (0x5a)*/ \
+        IAP_TRIG = 0xa5;        /*Send trigger command2 (0xa5)*/ \
+        __asm nop __endasm; }
+#endif
+
+/*----------------------------
+ Disable ISP/IAP/EEPROM function
+ Make MCU in a safe state
+ ----------------------------*/
+static void iap_idle(void)
+{
+    IAP_CONTR = 0;              //Close IAP function
+    IAP_CMD = CMD_IDLE;         //Clear command to standby
+    IAP_TRIG = 0;               //Clear trigger register
+    IAP_ADDRH = 0x80;           //Data ptr point to non-EEPROM area
+    IAP_ADDRL = 0;              //Clear IAP address to prevent misuse
+}
+
+static void iap_start(uint8_t cmd, uint16_t addr)
+{
+    IAP_CONTR = ENABLE_IAP;     //Open IAP function, and set wait time
+    IAP_CMD = cmd;
+    IAP_ADDRL = addr;
+    IAP_ADDRH = addr >> 8;
+}
+
+uint8_t iap_read_byte(uint16_t addr)
+{
+    uint8_t dat;
+
+    iap_start(CMD_READ, addr);
+    IAP_TRIGGER();
+    dat = IAP_DATA;
+    iap_idle();
+    return dat;
+}
+
+void iap_program_byte(uint16_t addr, uint8_t dat)
+{
+    iap_start(CMD_PROGRAM, addr);
+    IAP_DATA = dat;
+    IAP_TRIGGER();
+    iap_idle();
+}
+
+/* Long enough to lose timer0 interrupts: the lit digit would stay on
+ * at full strength, and the tick would fall behind by what it took */
+void iap_erase_sector(uint16_t addr)
+{
+    LED_DIGITS_OFF();
+    iap_start(CMD_ERASE, addr);
+    IAP_TRIGGER();
+    iap_idle();
+    timer0_lost(IAP_ERASE_COUNTS);
+}
+
+#endif /* WITH_JOURNAL */
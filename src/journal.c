@@ -0,0 +1,144 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include "stc15.h"
+#include "eeprom.h"
+#include "journal.h"
+
+#ifdef WITH_JOURNAL
+
+/* Two data flash sectors used in turn, the records appended one after
+ * the other:
+ *  0    id, never 0xFF: a slot that reads 0xFF here is free
+ *  1    nr_of_players
+ *  2,3  seq
+ *  4..6 time_left, 24 bits like on the wire
+ *  7    check
+ * The id goes in first and the check last, so a record torn by a power
+ * cut takes its slot but does not check out. Slots fill in order and
+ * the first free one is found by bisection, 6 reads. Once a sector is
+ * full the other one is erased and used, journal_tidy() erases it ahead
+ * of time. With two records per own move that is one erase every 32
+ * moves, a sector is good for 100000 of them. */
+#define REC_SIZE        8
+#define REC_SLOTS       (EEPROM_SECTOR / REC_SIZE)
+#define REC_CHECK       (REC_SIZE - 1)
+#define REC_SEED        0x5A    // an all 0 record does not check out
+#define TIDY_SPARE      8       // erase ahead with this few slots left
+
+static uint8_t cur;             // sector appended to
+static uint8_t slot;            // first free slot in it
+static uint16_t seq;            // for the next record
+static __bit other_erased;
+
+static uint16_t rec_addr(uint8_t sector, uint8_t i)
+{
+    return sector * EEPROM_SECTOR + i * REC_SIZE;
+}
+
+static uint8_t used_slots(uint8_t sector)
+{
+    uint8_t lo = 0, hi = REC_SLOTS, mid;
+
+    while (lo != hi) {
+        mid = (lo + hi) / 2;
+        if (iap_read_byte(rec_addr(sector, mid)) == 0xFF)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo;
+}
+
+static uint16_t rec_seq(uint8_t sector, uint8_t i)
+{
+    uint16_t addr = rec_addr(sector, i);
+    return iap_read_byte(addr + 2) | (uint16_t)iap_read_byte(addr + 3) << 8;
+}
+
+static bool rec_read(uint16_t addr, struct JournalRecord *r)
+{
+    uint8_t b[REC_SIZE], sum = REC_SEED, i;
+
+    for (i = 0; i != REC_SIZE; i++)
+        b[i] = iap_read_byte(addr + i);
+    for (i = 0; i != REC_CHECK; i++)
+        sum += b[i];
+    if (b[0] == 0xFF || b[REC_CHECK] != sum)
+        return false;
+
+    r->id = b[0];
+    r->nr_of_players = b[1];
+    r->seq = b[2] | (uint16_t)b[3] << 8;
+    r->time_left = (uint32_t)b[4] << 16 | (uint16_t)b[5] << 8 | b[6];
+    return true;
+}
+
+void journal_init(void)
+{
+    uint8_t used[2];
+    struct JournalRecord r;
+
+    used[0] = used_slots(0);
+    used[1] = used_slots(1);
+    /* The newer sector has the higher seq in its first record */
+    cur = used[1] && (!used[0] || (int16_t)(rec_seq(1, 0) - rec_seq(0, 0)) > 0);
+    slot = used[cur];
+    other_erased = !used[cur ^ 1];
+    seq = journal_last(&r) ? r.seq + 1 : 0;
+}
+
+/* Back from the end of the current sector into the other one */
+bool journal_last(struct JournalRecord *r)
+{
+    uint8_t sector = cur, i = slot;
+
+    for (;;) {
+        while (i)
+            if (rec_read(rec_addr(sector, --i), r))
+                return true;
+        if (sector != cur || other_erased)
+            return false;
+        sector ^= 1;
+        i = REC_SLOTS;
+    }
+}
+
+void journal_append(uint8_t id, uint8_t nr_of_players, uint32_t time_left)
+{
+    uint8_t b[REC_SIZE], sum = REC_SEED, i;
+    uint16_t addr;
+
+    if (slot == REC_SLOTS) {
+        cur ^= 1;
+        if (!other_erased)
+            iap_erase_sector(rec_addr(cur, 0));
+        other_erased = 0;   // the one we leave is full
+        slot = 0;
+    }
+
+    b[0] = id;
+    b[1] = nr_of_players;
+    b[2] = seq;
+    b[3] = seq >> 8;
+    b[4] = time_left >> 16;
+    b[5] = time_left >> 8;
+    b[6] = time_left;
+    for (i = 0; i != REC_CHECK; i++)
+        sum += b[i];
+    b[REC_CHECK] = sum;
+
+    addr = rec_addr(cur, slot++);
+    for (i = 0; i != REC_SIZE; i++)
+        iap_program_byte(addr + i, b[i]);
+    seq++;
+}
+
+void journal_tidy(void)
+{
+    if (!other_erased && slot >= REC_SLOTS - TIDY_SPARE) {
+        iap_erase_sector(rec_addr(cur ^ 1, 0));
+        other_erased = 1;
+    }
+}
+
+#endif /* WITH_JOURNAL */
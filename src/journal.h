@@ -0,0 +1,30 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Own game state at each own handoff, appended to the data flash. For
+ * boards whose DS1302 has no battery to keep the checkpoint. */
+struct JournalRecord {
+    uint16_t seq;               // counts records, the newest is highest
+    uint8_t id;
+    uint8_t nr_of_players;      // 0 for the start of a game
+    uint32_t time_left;
+};
+
+#ifdef WITH_JOURNAL
+//At power up: find where the newest record is
+void journal_init(void);
+//Newest record that checks out, false if there is none
+bool journal_last(struct JournalRecord *r);
+void journal_append(uint8_t id, uint8_t nr_of_players, uint32_t time_left);
+//At a quiet moment: erase the next sector if it is needed soon
+void journal_tidy(void);
+#else
+#define journal_init()
+#define journal_append(id, nr_of_players, time_left)
+#define journal_tidy()
+#endif /* WITH_JOURNAL */
+
+#endif /* JOURNAL_H */
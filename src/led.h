@@ -123,22 +123,18 @@ ledtable2[]
     0b10110110, //     Z
 };
 
+// what the state machine wants shown: ledtable[] indexes, dots bit per digit
 uint8_t tmpbuf[4];
-__bit   dot0;
-__bit   dot1;
-__bit   dot2;
-__bit   dot3;
+uint8_t dots;
 
-uint8_t dbuf[4];
+// segments, two buffers of 4: timer0 scans out dbuf[dbuf_show..+3],
+// and swaps to the other one at the start of a frame if dbuf_swap
+uint8_t dbuf[8];
+volatile uint8_t dbuf_show;
+volatile __bit dbuf_swap;
 
-#define clearTmpDisplay() { dot0=0; dot1=0; dot2=0; dot3=0; tmpbuf[0]=tmpbuf[1]=tmpbuf[2]=tmpbuf[3]=LED_BLANK; }
+#define clearTmpDisplay() { dots=0; tmpbuf[0]=tmpbuf[1]=tmpbuf[2]=tmpbuf[3]=LED_BLANK; }
 
 #define filldisplay(pos,val) { tmpbuf[pos]=(uint8_t)(val);}
-#define dotdisplay(pos,dp) { dot##pos=dp;}
-
-#define updateTmpDisplay() { uint8_t tmp; \
-                        tmp=ledtable[tmpbuf[0]]; if (dot0) tmp&=0x7F; dbuf[0]=tmp; \
-                        tmp=ledtable[tmpbuf[1]]; if (dot1) tmp&=0x7F; dbuf[1]=tmp; \
-                        tmp=ledtable[tmpbuf[3]]; if (dot3) tmp&=0x7F; dbuf[3]=tmp; \
-                        tmp=ledtable2[tmpbuf[2]]; if (dot2) tmp&=0x7F; dbuf[2]=tmp; }
+#define dotdisplay(pos,dp) { if (dp) dots |= 1<<(pos); else dots &= ~(1<<(pos)); }
 
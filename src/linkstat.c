@@ -0,0 +1,98 @@
+#include <stdint.h>
+#include "stc15.h"
+#include "timer0.h"
+#include "uart.h"
+#include "util.h"
+#include "linkstat.h"
+
+#ifdef WITH_RING_STATS
+
+/* OPC_LINK on the wire, one byte each, saturated:
+ *  DATA0   id of the clock that sent it
+ *  DATA1   hops round the ring
+ *  DATA2   round trip min, in units of 256 counts (278us)
+ *  DATA3   .. avg
+ *  DATA4   .. max
+ *  DATA5   max time a claim sat here, in units of 32 counts (35us)
+ * It goes round once, the sender takes it off again. */
+#define RTT_SHIFT       8
+#define HOLD_SHIFT      5
+
+/* Past this the timer0 counts have wrapped */
+#define STALE_TICKS     (6 * TMO_10MS)
+
+struct LinkStat linkstat_rtt;
+struct LinkStat linkstat_hold;
+uint8_t linkstat_hops;
+
+static uint16_t sent_counts;
+static uint8_t sent_tick;
+static __bit sent_pending;
+
+static void stat_add(struct LinkStat *s, uint16_t v)
+{
+    if (!s->n) {
+        s->min = s->max = v;
+        s->acc = (uint32_t)v << 3;
+    } else {
+        s->acc -= s->acc >> 3;
+        s->acc += v;
+    }
+    if (s->n != 0xFF)
+        s->n++;
+    s->avg = s->acc >> 3;
+    if (v < s->min)
+        s->min = v;
+    if (v > s->max)
+        s->max = v;
+    /* 1/16 of the way back each sample */
+    s->min += (s->avg - s->min) >> 4;
+    s->max -= (s->max - s->avg) >> 4;
+}
+
+void linkstat_sent(void)
+{
+    sent_counts = timer0_counts();
+    sent_tick = time_now;
+    sent_pending = 1;
+}
+
+void linkstat_back(void)
+{
+    uint16_t waited = uart1_rx_waited();
+
+    if (!sent_pending)
+        return;     // a resend of ours came back as well
+    sent_pending = 0;
+    linkstat_hops = rx_hops;
+    if (waited == UART1_AGE_MAX || (uint8_t)(time_now - sent_tick) > STALE_TICKS)
+        stat_add(&linkstat_rtt, LINKSTAT_MAX);
+    else
+        stat_add(&linkstat_rtt, timer0_counts() - waited - sent_counts);
+}
+
+void linkstat_held(void)
+{
+    uint16_t waited = uart1_rx_waited();
+
+    if (waited != UART1_AGE_MAX)
+        stat_add(&linkstat_hold, waited);
+}
+
+uint16_t linkstat_per_hop(uint16_t v)
+{
+    if (v == LINKSTAT_MAX || !linkstat_hops)
+        return LINKSTAT_MAX;
+    return v / linkstat_hops;
+}
+
+void linkstat_report(uint8_t id)
+{
+    uart1_send_packet(OPC_LINK, id, linkstat_hops,
+                      saturate(linkstat_rtt.min, RTT_SHIFT),
+                      (uint32_t)saturate(linkstat_rtt.avg, RTT_SHIFT) << 16 |
+                      (uint16_t)saturate(linkstat_rtt.max, RTT_SHIFT) << 8 |
+                      saturate(linkstat_hold.max, HOLD_SHIFT));
+}
+
+#endif /* WITH_RING_STATS */
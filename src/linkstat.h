@@ -0,0 +1,48 @@
+#ifndef LINKSTAT_H
+#define LINKSTAT_H
+
+#include <stdint.h>
+
+/* How quick the ring is from where this clock sits: the round trip of
+ * our own claims, CNTR tells over how many hops, and how long claims
+ * of others sat here before we sent them on. In counts of
+ * timer0_counts(), LINKSTAT_MAX is longer than that can tell. min and
+ * max creep back to the average, so one slow frame does not stay. */
+#define LINKSTAT_MAX    0xFFFF
+
+#ifdef WITH_RING_STATS
+struct LinkStat {
+    uint16_t min, avg, max;
+    uint32_t acc;               // avg * 8
+    uint8_t n;                  // samples, up to 255
+};
+
+extern struct LinkStat linkstat_rtt;
+extern struct LinkStat linkstat_hold;
+extern uint8_t linkstat_hops;   // clocks in the ring, as our claim counted
+
+//Our claim is handed to the uart
+void linkstat_sent(void);
+//.. and is back in rx_buf
+void linkstat_back(void);
+//The frame in rx_buf is about to go on from here
+void linkstat_held(void);
+//A round trip figure over the hops
+uint16_t linkstat_per_hop(uint16_t v);
+//Send it all round as an OPC_LINK frame, for whoever listens in
+void linkstat_report(uint8_t id);
+#else
+#define linkstat_sent()
+#define linkstat_back()
+#define linkstat_held()
+#define linkstat_report(id)
+#endif /* WITH_RING_STATS */
+
+/* In units of 10us and of 100us. A multiply by 1.2e6 / FOSC with 16
+ * bits after the point, so no division comes in: it comes out a unit
+ * low now and then */
+#define LINKSTAT_10US(counts)   ((uint32_t)(counts) * ((1200000UL << 8) / (FOSC >> 8)) >> 16)
+#define LINKSTAT_100US(counts)  ((uint32_t)(counts) * ((120000UL << 8) / (FOSC >> 8)) >> 16)
+#define LINKSTAT_10MS           (FOSC / 1200)   // counts
+
+#endif /* LINKSTAT_H */
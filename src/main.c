@@ -7,18 +7,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
-#ifdef __GNUC__
-#define __bit uint8_t
-#define __interrupt
-#define __at(_1)
-#define __critical
-extern volatile uint8_t P2 ;
-extern volatile uint8_t P3 ;
-extern volatile uint8_t EA;
-extern volatile uint8_t WDT_CONTR;
-#else
 #include "stc15.h"
-#endif
 
 #include "timer0.h"
 #include "uart.h"
@@ -26,36 +15,26 @@ extern volatile uint8_t WDT_CONTR;
 #include "led.h"
 #include "buttons.h"
 #include "beep.h"
+#include "calib.h"
+#include "sched.h"
+#include "power.h"
+#include "checkpoint.h"
+#include "journal.h"
+#include "linkstat.h"
+#include "ringstat.h"
+#include "bcdtime.h"
+#include "trace.h"
 
 //#define DEBUG
 
 // clear wdt
+#ifndef WDT_CLEAR
 #define WDT_CLEAR()    (WDT_CONTR |= 1 << 4)
+#endif
 
 // hardware configuration
 #include "hwconfig.h"
 
-static void display_scan_out(void)
-{
-    uint8_t tmp;
-    static uint8_t displaycounter = 0;
-
-    // turn off all digits, set high
-    LED_DIGITS_OFF();
-
-    /* The lower the compare the brighter the leds.
-     * keep >=4 otherwise we loose a digit! */
-    if(++displaycounter > 8)
-        displaycounter = 0;
-
-    if (displaycounter < 4 ) {
-        uint8_t digit = displaycounter;
-        LED_SEGMENT_PORT = dbuf[digit];
-        tmp = ~((1<<LED_DIGITS_PORT_BASE) << digit);
-        LED_DIGITS_PORT &= tmp;
-    }
-}
-
 #if 0
 uint8_t  temp;      // temperature sensor value
 // Formula was : 76-raw*64/637 - which makes use of integer mult/div routines
@@ -91,82 +70,181 @@ enum StateMachine {
     SM_MSG,           //4
     SM_MSG_CLAIM,     //5
     SM_BTN,           //6
+    SM_BAUD,          //7
 };
 
+/* One button event per state machine pass, whatever the state does
+ * not handle is gone after it */
+static enum ButtonEvent event;
+static uint32_t event_tick;     // when it happened
+
 static uint8_t recovery_btn_is_pressed(void) {
-    enum ButtonEvent ev = event;
-    /* We handled it so clear! */
-    event = EV_NONE;
-    return ev == EV_S3_LONG;
+    return event == EV_S3_LONG;
 }
 
+/* The move: S3 through the fast path, event_tick is when */
 static uint8_t btn_is_pressed(void) {
-    enum ButtonEvent ev = event;
-    /* We handled it so clear! */
-    event = EV_NONE;
-    return ev == EV_S3_SHORT;
-}
-
-static uint8_t msg_available(void) {
-    uint8_t rx;
-    /* Test&clear it atomically */
-    __critical {
-        rx = rx_packet_available;
-        rx_packet_available = 0;
-    }
-    return rx;
+    return event == EV_S3_PRESS;
 }
 
+/* Whether the state machine took a packet or an event this run */
+static __bit sm_took;
 
 /* Runtime config:
  * buzzer: enable the buzzer
- * debug: show state if nothing else is shown */
+ * debug: show state if nothing else is shown
+ * optimistic: start counting on PASSON, the CLAIM only confirms */
 enum RuntimeCfg
 {
-    RUN_CFG_NONE    = 0,
-    RUN_CFG_BUZZER  = 1<<0,
-    RUN_CFG_DEBUG   = 1<<1,
+    RUN_CFG_NONE       = 0,
+    RUN_CFG_BUZZER     = 1<<0,
+    RUN_CFG_DEBUG      = 1<<1,
+    RUN_CFG_OPTIMISTIC = 1<<2,
+    RUN_CFG_SLEEP      = 1<<3,
 };
-static enum RuntimeCfg cfg = RUN_CFG_BUZZER;
+/* Not static: the simulator sets RUN_CFG_SLEEP in it with --sleep */
+enum RuntimeCfg cfg = RUN_CFG_BUZZER | RUN_CFG_OPTIMISTIC;
+
+/* RUN_CFG_SLEEP: a clock that is only watching goes into power down
+ * once nothing came in for SLEEP_AFTER. The clock before it in the
+ * ring wakes it up again, see uart1_wake_next. */
+#define SLEEP_AFTER     (20 * TMO_SECOND)
+static deadline_t sleep_at;
+static __bit may_sleep;
+
+/* Nothing came in for this long, see journal_tidy() */
+#define TIDY_QUIET      (1 * TMO_SECOND)
+
+/* Display brightness: 0 follows the light, 1..DISPLAY_LEVELS fixed */
+static uint8_t brightness;
+
+/* The LDR reads high in the dark. Each level covers 128 of the 1024
+ * steps, and we only move once the light is DIM_HYST past its edges,
+ * so the display does not flicker between two levels. */
+#define DIM_HYST    24
+static void display_dim(void)
+{
+    static uint8_t level = DISPLAY_LEVEL_DEFAULT;
+    uint16_t dark, edge;
+
+    if (brightness) {
+        level = brightness - 1;
+    } else {
+        dark = adc_read(ADC_IN_LIGHT);
+        edge = (uint16_t)(DISPLAY_LEVELS - 1 - level) << 7;
+        if (dark + DIM_HYST < edge)
+            level++;
+        else if (dark > edge + 127 + DIM_HYST)
+            level--;
+    }
+    display_brightness(level);
+}
 
-//only 4 clocks for now
+//only 4 clocks for now, the host build simulates bigger rings
+#ifndef MAX_NR_OF_PLAYERS
 #define MAX_NR_OF_PLAYERS 4
+#endif
 #define INIT_VALUE  (0xFF)
 
+/* All times are in ticks of 10ms, on the wire as well */
+#define SECONDS(s)      ((uint32_t)(s) * TMO_SECOND)
+#define MAX_TIME        SECONDS(90 * 60)
+#define TIME_UNKNOWN    0xFFFFFFUL //Largest that fits the 24 bits on the wire
+/* Send our handoff again if no claim came round after it this long:
+ * a claim makes it round 64 clocks at 9600 in well under that */
+#define PASSON_RETRY    SECONDS(1)
+/* .. this many times, then it is up to the recovery button */
+#define PASSON_TRIES    5
+/* The countdown that starts the game goes this many hops before
+ * whoever it ends at claims the first move: over half a second at 9600 */
+#define COUNTDOWN_TTL   42
+#define COUNTDOWN_RETRY SECONDS(3)
+/* A clock that lost the game with its RAM asks the clock before it
+ * where it stands, this many times: the first may only bring a fast
+ * ring back down to 9600 */
+#define RESUME_RETRY    SECONDS(2)
+#define RESUME_TRIES    5
+
 static uint8_t id; //my assigned ID
 static uint8_t nr_of_players; //Detected number of players
 static uint8_t active_player_id;
-static uint16_t remaining_time[MAX_NR_OF_PLAYERS];
-
-static void send_assign(uint8_t your_id, uint16_t cfg_time)
+static uint32_t remaining_time[MAX_NR_OF_PLAYERS];
+/* Handoffs and claims carry the number of the move in DATA6, so a
+ * handoff sent again is told from the next one. move is the last one
+ * the ring told us of, my_move the last one we claimed. */
+static uint8_t move;
+static uint8_t my_move;
+
+static void send_assign(uint8_t your_id, uint32_t cfg_time)
 {
-    uart1_send_packet(OPC_ASSIGN, your_id, nr_of_players, active_player_id, cfg_time);
+    uart1_send_frame(0, 0, 0, OPC_ASSIGN, your_id, nr_of_players, active_player_id, cfg_time, move);
 }
 
-static void send_passon(uint8_t ttl)
+/* Handoffs carry the age of the press that made them (uart.c), so
+ * every clock starts the next player from the same moment, however
+ * long the frames took to get to it. One sent again is late by the
+ * time since the press. */
+static void send_passon(uint8_t ttl, uint16_t age, uint16_t late, uint8_t mv)
 {
     uint8_t next_id = (id + 1) % nr_of_players;
-    uint16_t rem_time = remaining_time[next_id];
+    uint32_t rem_time = remaining_time[next_id];
 
-    uart1_send_packet(OPC_PASSON, next_id, nr_of_players, ttl, rem_time);
+    uart1_send_aged(age, late, OPC_PASSON, next_id, nr_of_players, ttl, rem_time, mv);
 }
 
-static inline void send_claim(uint8_t id, uint16_t rem_time)
+static inline void send_claim(uint8_t hops, uint16_t age, uint16_t late, uint8_t id, uint32_t rem_time, uint8_t mv)
 {
-    uart1_send_packet(OPC_CLAIM, id, nr_of_players, cfg, rem_time);
+    uart1_send_frame(hops, age, late, OPC_CLAIM, id, nr_of_players, cfg, rem_time, mv);
 }
 
+/* Sends on the claim in rx_buf, as old as it is */
 static inline void send_other_claim(uint8_t id)
 {
-    uint16_t rem_time = remaining_time[id];
-    if(rem_time >= 60 * 90)
-        rem_time = 0xFFFF; //Send illegal if we do not know
-    send_claim(id, rem_time);
+    uint32_t rem_time = remaining_time[id];
+    if(rem_time >= MAX_TIME)
+        rem_time = TIME_UNKNOWN; //Send illegal if we do not know
+    linkstat_held();
+    send_claim(rx_hops, uart1_rx_age(), uart1_rx_late(), id, rem_time, rx_buf[7]);
+}
+
+static inline void send_my_claim(uint32_t rem_time, uint16_t age, uint16_t late)
+{
+    TRACE(TRACE_CLAIM_SENT, 0);
+    linkstat_sent();
+    send_claim(0, age, late, id, rem_time, my_move);
 }
 
-static inline void send_my_claim(uint16_t rem_time)
+/* For a frame sent again: the ticks since t, as many as fit */
+static uint16_t late_since(uint32_t t)
 {
-    send_claim(id, rem_time);
+    uint32_t late = ticks_since(t);
+    return late > UART1_LATE_MAX ? UART1_LATE_MAX : late;
+}
+
+/* The move in rx_buf, against the last one we know of */
+static int8_t rx_move(void)
+{
+    return (int8_t)(rx_buf[7] - move);
+}
+
+/* The clock before us sends its handoff again: it did not see our
+ * claim go by */
+static bool handoff_again(void)
+{
+    return rx_buf[0] == OPC_PASSON && rx_buf[1] == id && rx_buf[3] == 0 &&
+           rx_buf[7] == my_move;
+}
+
+/* Our claim made it round: how long that took, and in debug mode tell
+ * the ring, and ask how everybody is doing */
+static void my_claim_back(void)
+{
+    TRACE(TRACE_CLAIM_BACK, 0);
+    linkstat_back();
+    if (cfg & RUN_CFG_DEBUG) {
+        linkstat_report(id);
+        ringstat_start(id);
+    }
 }
 
 /* Displaying chars is non-trivial, so I added this convenience macro */
@@ -185,49 +263,187 @@ static void print4char(const char* str)
     }
 }
 
-/* Works for :
- * seconds to minutes:seconds
- * minutes to hours:minutes
- *
- * It will not display a leading 0
- *
- * */
-static void display_seconds_as_minutes(uint16_t time)
-{
-    uint8_t ten, dig, min = time / 60;
-    ten = (min /  10 )%10;
-    dig = (min /   1 )%10;
-    if(ten)
-        filldisplay(0, ten);
-    filldisplay(1, dig);
-
-    uint8_t sec = time % 60;
-    ten = (sec /  10 )%10;
-    dig = (sec /   1 )%10;
-    filldisplay(2, ten);
-    filldisplay(3, dig);
+/* Minutes:seconds, without a leading 0. Also hours:minutes. */
+static void display_mmss(uint8_t min, uint8_t sec)
+{
+    if(min >> 4)
+        filldisplay(0, min >> 4);
+    filldisplay(1, min & 0x0F);
+    filldisplay(2, sec >> 4);
+    filldisplay(3, sec & 0x0F);
 
     /* Always turn on dots to show we have minutes and seconds */
     dotdisplay(1, 1);
     dotdisplay(2, 1);
 }
 
+/* Game length in the config menu, as hours:minutes */
+static void display_minutes(uint8_t min)
+{
+    uint8_t hour = 0;
+    while(min >= 60) {
+        min -= 60;
+        hour++;
+    }
+    display_mmss(hour, bcd(min));
+}
+
+/* Remaining time: m:ss, or s.t with tenths below 10 seconds */
+static void display_time(uint32_t ticks)
+{
+    static struct BcdTime shown;
+
+    bcd_follow(&shown, ticks);
+
+    if(!shown.min && shown.sec < 0x10) {
+        filldisplay(1, shown.sec);
+        filldisplay(2, shown.cs >> 4);
+        dotdisplay(1, 1);
+    } else {
+        display_mmss(shown.min, shown.sec);
+    }
+}
+
+/* Encode tmpbuf into segments, but only when it differs from what
+ * we did last time, into the buffer timer0 is not scanning out. The
+ * swap waits for the next frame, so no frame shows half of each. */
+static void display_update(void)
+{
+    static uint8_t drawn[4];
+    static uint8_t drawn_dots;
+    uint8_t *seg;
+    uint8_t i, tmp;
+
+    if (dots == drawn_dots && !memcmp(tmpbuf, drawn, sizeof(drawn)))
+        return;
+    if (dbuf_swap)
+        return;     // last one not shown yet, try again next pass
+
+    seg = &dbuf[dbuf_show ^ 4];
+    for (i = 0; i != 4; i++) {
+        tmp = i == 2 ? ledtable2[tmpbuf[2]] : ledtable[tmpbuf[i]];
+        if (dots & 1 << i)
+            tmp &= 0x7F;
+        seg[i] = tmp;
+        drawn[i] = tmpbuf[i];
+    }
+    drawn_dots = dots;
+    dbuf_swap = 1;
+}
+
 /* Display an uint8_t on the last 3 digit */
 static void display_val(uint8_t val)
 {
-    uint8_t hun = (val / 100 ) % 10;
-    uint8_t ten = (val /  10 ) % 10;
-    uint8_t dig = (val /   1 ) % 10;
+    uint8_t hun = 0;
+    while(val >= 100) {
+        val -= 100;
+        hun++;
+    }
+    val = bcd(val);
 
     clearTmpDisplay();
 
     /* Do not display any leading zero */
     if(hun)
         filldisplay(1, hun);
-    if(hun || ten)
-        filldisplay(2, ten);
+    if(hun || val >> 4)
+        filldisplay(2, val >> 4);
+
+    filldisplay(3, val & 0x0F);
+}
+
+/* Debug pages, S2 steps through them during a game: the ring round
+ * trip ('c') and per hop ('h'), the average and with the dot the max,
+ * in ms. Page 0 is the clock as usual. */
+#ifdef WITH_RING_STATS
+#define LINK_PAGES  5
+
+static void display_link(uint8_t page)
+{
+    uint16_t v = page & 1 ? linkstat_rtt.avg : linkstat_rtt.max;
+    uint8_t hun;
 
-    filldisplay(3, dig);
+    clearTmpDisplay();
+    if (page > 2)
+        v = linkstat_per_hop(v);
+    filldisplay(0, page > 2 ? LED_h : LED_c);
+    dotdisplay(0, !(page & 1));
+    if (!linkstat_rtt.n || v == LINKSTAT_MAX) {
+        filldisplay(3, LED_DASH);
+        return;
+    }
+    /* x.xx below 10ms, xx.x above */
+    if (v >= LINKSTAT_10MS) {
+        v = LINKSTAT_100US(v);
+        dotdisplay(2, 1);
+    } else {
+        v = LINKSTAT_10US(v);
+        dotdisplay(1, 1);
+    }
+    hun = 0;
+    while(v >= 100) {
+        v -= 100;
+        hun++;
+    }
+    filldisplay(1, hun);
+    hun = bcd(v);
+    filldisplay(2, hun >> 4);
+    filldisplay(3, hun & 0x0F);
+}
+#endif /* WITH_RING_STATS */
+
+/* Time field of the last received message */
+static uint32_t rx_time(void)
+{
+    return (uint32_t)rx_buf[4] << 16 | (uint16_t)rx_buf[5] << 8 | rx_buf[6];
+}
+
+/* Debug frames and RESUME go by whatever the state machine waits for,
+ * so they never sit in the RX queue behind a frame it leaves there.
+ * Built without debug frames we still send them on, for the clocks
+ * that have them. */
+static bool ring_frame(void)
+{
+    switch (rx_buf[0]) {
+        case OPC_RESUME:
+            /* Round once. The clock before the one that asks tells it
+             * where the game stands, as the recovery button would. */
+            if(rx_buf[1] == id)
+                return true;
+            if(active_player_id < nr_of_players && rx_buf[2] == nr_of_players &&
+               rx_buf[1] == (id + 1) % nr_of_players)
+                send_assign(rx_buf[1], remaining_time[rx_buf[1]]);
+            else
+                uart1_send_frame(rx_hops, 0, 0, OPC_RESUME, rx_buf[1], rx_buf[2], 0, 0, 0);
+            return true;
+#ifdef WITH_RING_STATS
+        case OPC_STATS:
+            ringstat_frame(id);
+            return true;
+#else
+        case OPC_STATS:
+#endif
+        case OPC_LINK:
+            /* Round once, the one who sent it ends it */
+            if(rx_buf[1] != id && !rx_forwarded) {
+                linkstat_held();
+                uart1_send_frame(rx_hops, uart1_rx_age(), uart1_rx_late(), rx_buf[0],
+                                 rx_buf[1], rx_buf[2], rx_buf[3], rx_time(), rx_buf[7]);
+            }
+            return true;
+        default:
+            return false;
+    }
+}
+
+static uint8_t msg_available(void) {
+    /* Copies the oldest packet into rx_buf */
+    while (uart1_receive()) {
+        sm_took = 1;
+        if (!ring_frame())
+            return 1;
+    }
+    return 0;
 }
 
 static uint8_t save_claim_data(void)
@@ -236,33 +452,167 @@ static uint8_t save_claim_data(void)
     uint8_t other_id = rx_buf[1];
     //nr_of_players    = rx_buf[2];
     cfg              = rx_buf[3];
-    uint16_t secs = (uint16_t)rx_buf[4] << 8 | rx_buf[5];
+    uint32_t ticks = rx_time();
     if(other_id != id) {
         /* keep track of its time, but only if it is valid.
          * Otherwise keep existing time.
          * This means we will send the 'original' time in a
          * claim message */
-        if( secs < 90 * 60)
-            remaining_time[other_id] = secs;
+        if( ticks < MAX_TIME)
+            remaining_time[other_id] = ticks;
     }
     return other_id;
 }
 
+/* Running clocks are charged every tick that passed since the last
+ * call, so no part of a second gets lost at a handoff */
+static uint32_t count_mark;
+static uint32_t handoff_tick;   // our move starts here once claimed
+
+static void count_start_at(uint32_t t)
+{
+    count_mark = t;
+}
+
+static void count_start(void)
+{
+    count_start_at(ticks_now());
+}
+
+/* The tick the handoff in rx_buf happened in. One that took too long
+ * to get here, like the first after the countdown, starts now, less
+ * what it was sent late. */
+static uint32_t rx_handoff_tick(void)
+{
+    uint16_t age = uart1_rx_age();
+    return (age == UART1_AGE_MAX ? ticks_now() : ticks_before(age)) - uart1_rx_late();
+}
+
+static void count_start_rx(void)
+{
+    count_start_at(rx_handoff_tick());
+}
+
+/* Up to tick t, which may be a little before the last call when a
+ * button press came in just after we looked */
+static uint32_t count_ticks_to(uint32_t t)
+{
+    uint32_t ticks = t - count_mark;
+    if((int32_t)ticks < 0)
+        return 0;
+    count_mark = t;
+    return ticks;
+}
+
+static uint32_t count_ticks(void)
+{
+    return count_ticks_to(ticks_now());
+}
+
+/* Returns true once the time is up */
+static bool count_down(uint32_t *time, uint32_t ticks)
+{
+    if(*time > ticks) {
+        *time -= ticks;
+        return false;
+    }
+    *time = 0;
+    return true;
+}
+
+#if MAX_NR_OF_PLAYERS < CKPT_PLAYERS
+#error "the checkpoint keeps more players than there are"
+#endif
+
+/* At a handoff, mover now has the move. The burst takes the DS1302
+ * some 200 bit clocks, the uart keeps going in its interrupt. */
+static void checkpoint(uint8_t mover, uint32_t time_left)
+{
+    struct Checkpoint c;
+
+    c.id = id;
+    c.nr_of_players = nr_of_players;
+    c.active_player_id = mover;
+    c.cfg = cfg;
+    c.baud = uart1_baud_index();
+    c.move = move;
+    c.time_left = time_left;
+    memcpy(c.remaining_time, remaining_time, sizeof(c.remaining_time));
+    ckpt_save(&c);
+}
+
+/* Our time after a reset with the DS1302 RAM gone: once the ring
+ * shows a game going on, the last one in the journal if it is of
+ * this game. There is no telling how long we were gone. */
+#ifdef WITH_JOURNAL
+static uint32_t journal_time(uint32_t ring_time)
+{
+    struct JournalRecord r;
+
+    if (journal_last(&r) && r.id == id && r.nr_of_players == nr_of_players &&
+        r.time_left < MAX_TIME)
+        return r.time_left;
+    return ring_time;
+}
+
+/* After a reset with the DS1302 RAM gone: whether the journal has a
+ * game going on, and who we were in it */
+static bool journal_game(void)
+{
+    struct JournalRecord r;
+
+    if (!journal_last(&r) || !r.nr_of_players)
+        return false;
+    id = r.id;
+    nr_of_players = r.nr_of_players;
+    return true;
+}
+#else
+#define journal_time(ring_time) (ring_time)
+#define journal_game()          false
+#endif
+
 static void statemachine(void)
 {
     static enum StateMachine state = SM_START;
-    static uint8_t statemachine_delay = 0;
-    static uint16_t seconds_left;
+    static deadline_t statemachine_delay = 0;
+    static uint32_t time_left;
     static uint8_t game_duration_in_min;
-    static uint8_t decrement_timer;
-    static uint16_t other_player_time;
+    static deadline_t beep_timer;
+    static uint32_t other_player_time;
     static uint8_t cfg_state;
+    static uint32_t claimed_time;
+    static __bit claim_pending;
+    static __bit passon_pending;
+    static deadline_t passon_retry;
+    static uint8_t passon_tries;
+    static uint8_t passon_move;         // the move it hands over
+    static uint32_t passon_tick;        // .. and when it was pressed
+    static __bit passon_pressed;        // not the countdown, which has no press
+    static deadline_t resume_retry;
+    static uint8_t resume_tries;
+#ifdef WITH_RING_STATS
+    static uint8_t link_page;
+#endif
 
-    /* If state machine should wait, do so */
-    if(!timer_elapsed(&statemachine_delay)) {
-        return;
+    /* The countdown: the next hop waits for the beep of this one and a
+     * little silence. Whatever else comes in, the claim it ends with and
+     * what follows that, is taken meanwhile, so the queue does not fill. */
+    if(!deadline_passed(statemachine_delay)) {
+        uint8_t opc = uart1_peek();
+        if(opc == 0 || opc == OPC_PASSON)
+            return;
     }
 
+    event = buttons_event(&event_tick);
+    if (event != EV_NONE)
+        sm_took = 1;
+
+    /* Also while nothing else is taken, as when waiting for a move */
+    while (uart1_receive_opc(OPC_LINK) || uart1_receive_opc(OPC_STATS) ||
+           uart1_receive_opc(OPC_RESUME))
+        ring_frame();
+
     /* Clear display AFTER check timer:
      * whoever sets the timer also has a one time option to set the screen. */
     clearTmpDisplay();
@@ -272,7 +622,9 @@ static void statemachine(void)
         case SM_START: // 0
             /* Init 'global' variables */
             id = 0xFF;
-            seconds_left = 0xFFFF;
+            passon_pending = 0;
+            move = my_move = 0;
+            time_left = TIME_UNKNOWN;
             other_player_time = 0;
             game_duration_in_min = 30;
             active_player_id = INIT_VALUE;
@@ -280,6 +632,38 @@ static void statemachine(void)
             cfg_state = 0;
             memset(remaining_time, 0xFF, sizeof(remaining_time));
             state = SM_BTN_INIT;
+
+            /* Reset during a game: straight back into it, unless S1
+             * is held down. The seconds since the checkpoint go to
+             * whoever had the move. */
+            if (SW1) {
+                struct Checkpoint c;
+                uint16_t age = ckpt_load(&c);
+                if (age == CKPT_NONE) {
+                    /* Gone as well: ask the ring, if we were in a game */
+                    if (journal_game())
+                        resume_tries = RESUME_TRIES;
+                    break;
+                }
+                id = c.id;
+                nr_of_players = c.nr_of_players;
+                active_player_id = c.active_player_id;
+                cfg = c.cfg;
+                uart1_baud_resume(c.baud);
+                move = my_move = c.move;
+                time_left = c.time_left;
+                memcpy(remaining_time, c.remaining_time, sizeof(c.remaining_time));
+                count_start();
+                if (active_player_id == id) {
+                    count_down(&time_left, SECONDS(age));
+                    state = SM_BTN;
+                } else {
+                    other_player_time = SECONDS(age);
+                    if (active_player_id < MAX_NR_OF_PLAYERS)
+                        count_down(&remaining_time[active_player_id], SECONDS(age));
+                    state = SM_MSG;
+                }
+            }
             break;
 
         case SM_BTN_INIT: // 1
@@ -288,31 +672,39 @@ static void statemachine(void)
                 state = SM_MSG_SLAVE;
                 break;
             }
+            if (resume_tries && deadline_passed(resume_retry)) {
+                resume_tries--;
+                uart1_send_packet(OPC_RESUME, id, nr_of_players, 0, 0);
+                deadline_set(&resume_retry, RESUME_RETRY);
+            }
 
             /* S3 is start game */
             if(event == EV_S3_SHORT)
             {
                 /* We are master! kick off by sending assign */
                 id = 0;
-                seconds_left = game_duration_in_min * 60;
+                resume_tries = 0;
+                time_left = SECONDS(game_duration_in_min * 60);
                 for(uint8_t i = 0 ; i < MAX_NR_OF_PLAYERS; i++) {
-                    remaining_time[i] = seconds_left;
+                    remaining_time[i] = time_left;
                 }
-                send_assign(id + 1, seconds_left); //Next is player 1
+                ckpt_clear();
+                journal_append(id, 0, time_left);
+                send_assign(id + 1, time_left); //Next is player 1
                 beep_start(1 * TMO_10MS);
                 state = SM_MSG_MASTER;
             /* S1 + S2 is change option we are editting */
             } else if(event == EV_S1S2_LONG) {
                 /* Change cfg */
                 cfg_state++;
-                if(cfg_state > 2)
+                if(cfg_state > 6)
                     cfg_state = 0;
             } else {
                 /* All other options edit the current option */
                 switch(cfg_state) {
                     case 0:
                         if(time_now & TICK_320MS) {
-                            display_seconds_as_minutes(game_duration_in_min);
+                            display_minutes(game_duration_in_min);
                         }
 
                         switch(event){
@@ -355,11 +747,76 @@ static void statemachine(void)
                             default:
                                 break;
                         }
+                        break;
+
+                    case 3:
+                        display_val(!!(cfg & RUN_CFG_OPTIMISTIC));
+                        display_char(0, 'O');
+
+                        switch(event){
+                            case EV_S1_SHORT:
+                            case EV_S2_SHORT:
+                                cfg ^= RUN_CFG_OPTIMISTIC;
+                                break;
+                            default:
+                                break;
+                        }
+                        break;
+
+                    case 4:
+                        /* Tick calibrated against the DS1302, S1/S2
+                         * start measuring again */
+                        display_val(calib_done());
+                        display_char(0, 'C');
+
+                        switch(event){
+                            case EV_S1_SHORT:
+                            case EV_S2_SHORT:
+                                calib_restart();
+                                break;
+                            default:
+                                break;
+                        }
+                        break;
+
+                    case 5:
+                        /* A is follow the light */
+                        if(brightness)
+                            display_val(brightness);
+                        else
+                            display_char(3, 'A');
+                        display_char(0, 'L');
+
+                        switch(event){
+                            case EV_S1_SHORT:
+                                if(brightness < DISPLAY_LEVELS)
+                                    brightness++;
+                                break;
+                            case EV_S2_SHORT:
+                                if(brightness > 0)
+                                    brightness--;
+                                break;
+                            default:
+                                break;
+                        }
+                        break;
+
+                    case 6:
+                        /* Power down while waiting, for battery use */
+                        display_val(!!(cfg & RUN_CFG_SLEEP));
+                        display_char(0, 'S');
+
+                        switch(event){
+                            case EV_S1_SHORT:
+                            case EV_S2_SHORT:
+                                cfg ^= RUN_CFG_SLEEP;
+                                break;
+                            default:
+                                break;
+                        }
+                        break;
                 }
             }
-
-            /* We handled the event so clear it */
-            event = EV_NONE;
             break;
 
         case SM_MSG_MASTER: // 2
@@ -370,10 +827,10 @@ static void statemachine(void)
                         /* We got our assign back, so start the game! */
                         if(rx_buf[3] == INIT_VALUE)
                         {
-                            uint8_t l = 42; //Random...
                             nr_of_players = rx_buf[1]; //last id
-                            send_passon(l);
-                            state = SM_MSG;
+                            /* Speed up the line before the game starts */
+                            uart1_baud_negotiate();
+                            state = SM_BAUD;
                         } else {
                             state = SM_MSG_SLAVE;
                         }
@@ -388,12 +845,31 @@ static void statemachine(void)
                         state = SM_MSG_SLAVE;
                         break;
 
+                    case OPC_BAUD: //Taken by uart.c already
+                    case OPC_LINK:
+                    case OPC_STATS:
+                    case OPC_RESUME:
                     case OPC_PANIC:
                         break;
                 }
             }
             break;
 
+        case SM_BAUD: // 7
+            print4char("BAUD");
+            if (!uart1_baud_busy()) {
+                passon_move = move + 1;
+                passon_pressed = 0;
+                send_passon(COUNTDOWN_TTL, 0, 0, passon_move);
+                /* Lost on the way, the next clock gets the first move
+                 * without the countdown */
+                passon_pending = 1;
+                passon_tries = PASSON_TRIES;
+                deadline_set(&passon_retry, COUNTDOWN_RETRY);
+                state = SM_MSG;
+            }
+            break;
+
         case SM_MSG_SLAVE: //3
             switch((enum OPC)rx_buf[0]){
                 case OPC_ASSIGN:
@@ -402,22 +878,32 @@ static void statemachine(void)
                      * and the game time */
                     id = rx_buf[1];
                     active_player_id = rx_buf[3];
-                    seconds_left = (((uint16_t)rx_buf[4]) << 8) | rx_buf[5];
+                    time_left = rx_time();
                     if(active_player_id == INIT_VALUE) {
                         /* Init fase */
                         for(uint8_t i = 0 ; i < MAX_NR_OF_PLAYERS; i++) {
-                            remaining_time[i] = seconds_left;
+                            remaining_time[i] = time_left;
                         }
-                        send_assign(id + 1, seconds_left);
+                        move = my_move = 0;
+                        ckpt_clear();
+                        journal_append(id, 0, time_left);
+                        send_assign(id + 1, time_left);
                         state = SM_MSG;
                     } else {
                         /* Whoops game already started!
                          * nr_of_players is NOT valid on INIT_VALUE.
                          */
                         nr_of_players = rx_buf[2];
+                        /* Our move: the clock before us counted it down
+                         * meanwhile, if it knows our time */
+                        if(active_player_id != id || time_left >= MAX_TIME)
+                            time_left = journal_time(time_left);
+                        move = rx_buf[7];
                         if(active_player_id == id) {
                             //Send claim since we are the current active player
-                            send_my_claim(seconds_left);
+                            my_move = move;
+                            handoff_tick = rx_handoff_tick();
+                            send_my_claim(time_left, uart1_rx_age(), uart1_rx_late());
                             state = SM_MSG_CLAIM;
                         } else {
                             /* Go wait for any message, game started already */
@@ -431,15 +917,18 @@ static void statemachine(void)
                     id               = rx_buf[1]; //This my id, if ttl is 0
                     nr_of_players    = rx_buf[2];
                     if(rx_buf[3] == 0) { //ttl == 0 => it is our turn now
-                        seconds_left = (((uint16_t)rx_buf[4]) << 8) | rx_buf[5];
+                        time_left = journal_time(rx_time());
                         //Best guess, for next player
-                        remaining_time[(id + 1) % nr_of_players] = seconds_left;
-                        send_my_claim(seconds_left);
+                        remaining_time[(id + 1) % nr_of_players] = time_left;
+                        move = my_move = rx_buf[7];
+                        active_player_id = id;
+                        handoff_tick = rx_handoff_tick();
+                        send_my_claim(time_left, uart1_rx_age(), uart1_rx_late());
                         state = SM_MSG_CLAIM;
                     } else {
                         /* Unlikely situation that we rebooted during count down
                          * Just passon and goto SM_MSG */
-                        send_passon(rx_buf[3] - 1);
+                        send_passon(rx_buf[3] - 1, 0, 0, rx_buf[7]);
                         state = SM_MSG;
                     }
                     break;
@@ -449,12 +938,18 @@ static void statemachine(void)
                         /* Just send on claim and wait for recovery assign
                          * or the regular passon message */
                         uint8_t other_id = save_claim_data();
-                        send_other_claim(other_id);
+                        move = rx_buf[7];
+                        if(!rx_forwarded)
+                            send_other_claim(other_id);
                         state = SM_BTN_INIT;
                     }
                     break;
 
                 /* On anything else, just stay here */
+                case OPC_BAUD:
+                case OPC_LINK:
+                case OPC_STATS:
+                case OPC_RESUME:
                 case OPC_PANIC:
                     state = SM_BTN_INIT;
                     break;
@@ -471,16 +966,30 @@ static void statemachine(void)
 
                     case OPC_CLAIM:
                     {
-                        uint8_t other_id = save_claim_data();
+                        /* One sent again for a move the ring is past
+                         * only goes on, to the clock that asked for it */
+                        bool stale = rx_move() < 0;
+                        uint8_t other_id = stale ? rx_buf[1] : save_claim_data();
                         if(other_id != id) {
+                            if(!rx_forwarded)
+                                send_other_claim(other_id);
+                            if(stale)
+                                break;
                             /* Send message onto the assigned one.
-                             * But keep track of its time */
+                             * But keep track of its time. Any claim
+                             * this late means our handoff got through. */
+                            move = rx_buf[7];
                             active_player_id = other_id;
-                            send_other_claim(other_id);
+                            passon_pending = 0;
+                            //Counter reset voor display
+                            count_start_rx();
+                            other_player_time = 0;
+                            checkpoint(other_id, time_left);
+                        } else {
+                            /* Our own optimistic claim coming back
+                             * after we already passed on */
+                            linkstat_back();
                         }
-                        //Counter reset voor display
-                        set_timer(&decrement_timer, 1 * TMO_SECOND);
-                        other_player_time = 0;
                     }
                     break;
 
@@ -489,19 +998,47 @@ static void statemachine(void)
                         //uint8_t r_id     = rx_buf[1]; //This my id, if ttl is 0
                         nr_of_players    = rx_buf[2];
                         uint8_t ttl      = rx_buf[3];
-                        //uint16_t secs    = rx_buf[4];
-                        //secs = secs << 8 | rx_buf[5];
+                        //uint32_t ticks   = rx_time();
                         if(ttl == 0) {
-                            send_my_claim(seconds_left);
+                            if(rx_buf[1] != id)
+                                break;
+                            if(rx_buf[7] == my_move) {
+                                /* Ours, but we moved on since: the
+                                 * clock before us did not see any
+                                 * claim after its handoff */
+                                send_my_claim(TIME_UNKNOWN, 0, late_since(handoff_tick));
+                                break;
+                            }
+                            if(rx_move() <= 0)
+                                break;
+                            passon_pending = 0;
+                            move = my_move = rx_buf[7];
+                            active_player_id = id;
+                            handoff_tick = rx_handoff_tick();
+                            send_my_claim(time_left, uart1_rx_age(), uart1_rx_late());
                             beep_start(3 * TMO_100MS);
-                            state = SM_MSG_CLAIM;
+                            if(cfg & RUN_CFG_OPTIMISTIC) {
+                                /* Start counting now, the claim going
+                                 * round only confirms it */
+                                claimed_time = time_left;
+                                claim_pending = 1;
+                                count_start_at(handoff_tick);
+                                if(time_left < SECONDS(60))
+                                    time_left = SECONDS(60);
+                                TRACE(TRACE_CLOCK_START, time_left * 10);
+                                state = SM_BTN;
+                                checkpoint(id, time_left);
+                                journal_append(id, nr_of_players, time_left);
+                            } else {
+                                state = SM_MSG_CLAIM;
+                            }
                         } else {
                             /* TTL != 0 means we are in init fase! */
                             uint8_t tmo = ((255 - ttl) / 10) * TMO_10MS;
                             beep_start(tmo);
 
                             /* Add 'silence' by waiting a little longer before continuing */
-                            set_timer(&statemachine_delay, tmo + 2 * TMO_10MS);
+                            deadline_set(&statemachine_delay, tmo + 2 * TMO_10MS);
 
                             /* Show the number of players detected during countdown:
                              * for player 1 of 2 it show "P0-2" */
@@ -512,27 +1049,43 @@ static void statemachine(void)
 
                             /* Send message straight away,
                              * we will wait before processing another */
-                            send_passon(ttl - 1);
+                            send_passon(ttl - 1, 0, 0, rx_buf[7]);
                         }
                     }
                     break;
 
+                    case OPC_BAUD:
+                    case OPC_LINK:  //Taken by msg_available() already
+                    case OPC_STATS:
+                    case OPC_RESUME:
                     case OPC_PANIC:
                     break;
                 }
             } else {
                 /* Display remaining time of current active player (not us) */
-                display_seconds_as_minutes(other_player_time);
+                display_time(other_player_time);
 
-                if(timer_elapsed(&decrement_timer)) {
-                    other_player_time++;
-                    remaining_time[active_player_id]--;
-                    set_timer(&decrement_timer, 1 * TMO_SECOND);
-                }
+                uint32_t ticks = count_ticks();
+                other_player_time += ticks;
+                if(active_player_id < MAX_NR_OF_PLAYERS)
+                    count_down(&remaining_time[active_player_id], ticks);
                 if(recovery_btn_is_pressed()) {
                     uint8_t next_id = (id + 1) % nr_of_players;
                     send_assign(next_id, remaining_time[next_id]);
                 }
+                /* No claim came by: our handoff or the claim got lost
+                 * on the line. A clock that did get it answers with
+                 * its claim again. As late as the press behind it,
+                 * the countdown starts whoever it gets to now. */
+                if(passon_pending && deadline_passed(passon_retry)) {
+                    if(passon_pressed)
+                        send_passon(0, 0, late_since(passon_tick), passon_move);
+                    else
+                        send_passon(0, UART1_AGE_MAX, 0, passon_move);
+                    deadline_set(&passon_retry, PASSON_RETRY);
+                    if(--passon_tries == 0)
+                        passon_pending = 0;
+                }
             }
             break;
 
@@ -541,38 +1094,121 @@ static void statemachine(void)
             if (msg_available()) {
                 if(rx_buf[0] == OPC_CLAIM && (rx_buf[1] == id)) {
                     /* We got OUR claim back. So lets start down counting! */
-                    set_timer(&decrement_timer, 1 * TMO_SECOND);
+                    my_claim_back();
+                    count_start_at(handoff_tick);
                     /* Always have atleast 60 seconds of play */
-                    if(seconds_left < 60)
-                        seconds_left = 60;
+                    if(time_left < SECONDS(60))
+                        time_left = SECONDS(60);
+                    TRACE(TRACE_CLOCK_START, time_left * 10);
                     state = SM_BTN;
+                    checkpoint(id, time_left);
+                    journal_append(id, nr_of_players, time_left);
+                } else if(handoff_again()) {
+                    send_my_claim(time_left, 0, late_since(handoff_tick));
                 }
             } else {
                 /* Recover by resending our claim message */
                 if(recovery_btn_is_pressed())
-                    send_my_claim(seconds_left);
+                    send_my_claim(time_left, 0, late_since(handoff_tick));
             }
             break;
 
         case SM_BTN: // 6
-            /* Display our remaining time */
-            display_seconds_as_minutes(seconds_left);
-            if (btn_is_pressed()) {
-                send_passon(0); // ttl 0 = next
+        {
+            /* Charge what passed since the last pass, or up to the
+             * tick the move button went down in, and display our
+             * remaining time */
+            bool moved = btn_is_pressed();
+            if(count_down(&time_left, moved ? count_ticks_to(event_tick) : count_ticks()) &&
+               deadline_passed(beep_timer)) {
+                /* Out of time, beep every second */
+                deadline_set(&beep_timer, 1 * TMO_SECOND);
                 beep_start(1 * TMO_10MS);
-                state = SM_MSG;
-            } else {
-                if(timer_elapsed(&decrement_timer)) {
-                    set_timer(&decrement_timer, 1 * TMO_SECOND);
-
-                    if(seconds_left)
-                        seconds_left--;
-                    else
-                        beep_start(1 * TMO_10MS);
+            }
+            display_time(time_left);
+            /* Claims are taken after ours came back as well: one sent
+             * again for a repeated handoff comes round a second time,
+             * and would hold up the frames behind it until we move */
+            if ((claim_pending || uart1_peek() == OPC_CLAIM) && msg_available()) {
+                if(rx_buf[0] == OPC_CLAIM) {
+                    if(rx_move() < 0) {
+                        /* Sent again for a move before ours, on to
+                         * the clock that asked for it */
+                        if(rx_buf[1] != id && !rx_forwarded)
+                            send_other_claim(rx_buf[1]);
+                    } else if(rx_buf[1] == id) {
+                        /* The ring agrees it is our move */
+                        if(claim_pending)
+                            my_claim_back();
+                        claim_pending = 0;
+                    } else {
+                        /* Somebody else holds the move. Give back the
+                         * time we counted before the ring agreed, and
+                         * follow their claim */
+                        if(claim_pending)
+                            time_left = claimed_time;
+                        claim_pending = 0;
+                        active_player_id = save_claim_data();
+                        move = rx_buf[7];
+                        if(!rx_forwarded)
+                            send_other_claim(active_player_id);
+                        count_start_rx();
+                        other_player_time = 0;
+                        state = SM_MSG;
+                        checkpoint(active_player_id, time_left);
+                        break;
+                    }
+                } else if(handoff_again()) {
+                    send_my_claim(claimed_time, 0, late_since(handoff_tick));
                 }
             }
+            /* Blink the last dot until our claim is confirmed. After
+             * that the ring is quiet until we move: time to erase
+             * flash, should the journal need it soon. The erase holds
+             * off interrupts, so not while debug frames still go by. */
+            if (claim_pending) {
+                if (time_now & TICK_320MS)
+                    dotdisplay(3, 1);
+            } else if (uart1_idle() && deadline_passed(sleep_at - SLEEP_AFTER + TIDY_QUIET)) {
+                journal_tidy();
+            }
+
+            if (moved) {
+                buttons_s3_used();
+                claim_pending = 0;
+                TRACE(TRACE_CLOCK_STOP, time_left * 10);
+                passon_move = ++move;
+                active_player_id = (id + 1) % nr_of_players;
+                passon_tick = event_tick;
+                passon_pressed = 1;
+                send_passon(0, buttons_press_age(), 0, passon_move); // ttl 0 = next
+                passon_pending = 1;
+                passon_tries = PASSON_TRIES;
+                deadline_set(&passon_retry, PASSON_RETRY);
+                beep_start(1 * TMO_10MS);
+                state = SM_MSG;
+                checkpoint((id + 1) % nr_of_players, time_left);
+                journal_append(id, nr_of_players, time_left);
+            }
+        }
             break;
     }
+    TRACE(TRACE_STATE, state);
+
+    /* Only while just watching may the ISR pass on claims by itself */
+    uart1_forward_id = (state == SM_MSG) ? id : INIT_VALUE;
+    /* Same for going to sleep. Whoever has it on wakes the next one */
+    may_sleep = state == SM_MSG && (cfg & RUN_CFG_SLEEP);
+    uart1_wake_next = !!(cfg & RUN_CFG_SLEEP);
+
+#ifdef WITH_RING_STATS
+    if ((cfg & RUN_CFG_DEBUG) && (state == SM_MSG || state == SM_BTN)) {
+        if (event == EV_S2_SHORT)
+            link_page = (link_page + 1) % LINK_PAGES;
+        if (link_page)
+            display_link(link_page);
+    }
+#endif
 
     /* If nothing on screen, show current state.
      * Usefull debugging aid. */
@@ -585,14 +1221,76 @@ static void statemachine(void)
         display_val(state);
     }
 
-    /* Copy buffer to buffer used by scan out */
-    updateTmpDisplay();
+    /* Hand it to the scan out, if anything changed */
+    display_update();
+}
+
+/* Work for the state machine: something came in since it last ran,
+ * or it took something then and more is waiting. A packet it leaves
+ * in the queue does not keep it running, it looks again every tick. */
+static uint8_t sm_seen;
+
+static uint8_t sm_arrivals(void)
+{
+    return uart1_arrivals() + buttons_arrivals();
+}
+
+static bool statemachine_ready(void)
+{
+    return sm_arrivals() != sm_seen ||
+           (sm_took && (uart1_pending() || buttons_pending()));
+}
+
+static void statemachine_task(void)
+{
+    uint8_t arrived = sm_arrivals();
+
+    /* Anything coming in keeps us awake */
+    if (arrived != sm_seen)
+        deadline_set(&sleep_at, SLEEP_AFTER);
+    sm_seen = arrived;
+    sm_took = 0;
+    statemachine();
+}
+
+static bool s3_ready(void)
+{
+    return s3_press;
+}
+
+static void beep_task(void)
+{
+    beep_handle(!!(cfg & RUN_CFG_BUZZER));
+}
+
+/* Most urgent first: the move button and frames */
+static const struct Task __code tasks[] = {
+    { buttons_read,         s3_ready,           1 * TMO_10MS },
+    { statemachine_task,    statemachine_ready, 1 * TMO_10MS },
+    { uart1_poll,           NULL,               1 * TMO_10MS },
+    { beep_task,            beep_pending,       1 * TMO_10MS },
+    { calib_poll,           NULL,               1 * TMO_10MS },
+    { display_dim,          NULL,               1 * TMO_100MS },
+};
+#define TASKS   (sizeof(tasks) / sizeof(tasks[0]))
+
+static void deep_sleep(void)
+{
+    /* Timer0 stood still meanwhile, the measurement is off */
+    if (power_down()) {
+        calib_restart();
+        sched_restart();
+    }
+    deadline_set(&sleep_at, SLEEP_AFTER);
 }
 
 int main()
 {
     /* Init the hardware  */
     timer0_init();
+    calib_init();
+    journal_init();
+    adc_init();
     uart1_init();
 
     /* Enable interrupts, AFTER hardware setup */
@@ -601,10 +1299,14 @@ int main()
     // LOOP
     while (1)
     {
-        beep_handle(!!(cfg & RUN_CFG_BUZZER));
-        buttons_read();
-        display_scan_out();
-        statemachine();
+        /* Nothing due: sleep until the next interrupt, or longer
+         * when only watching */
+        if (!sched_run(tasks, TASKS)) {
+            if (may_sleep && deadline_passed(sleep_at) && uart1_idle())
+                deep_sleep();
+            else
+                POWER_IDLE_UNLESS(sched_pending(tasks, TASKS));
+        }
 
         WDT_CLEAR();
     }
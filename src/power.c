@@ -0,0 +1,114 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include "stc15.h"
+#include "hwconfig.h"
+#include "ds1302.h"
+#include "timer0.h"
+#include "util.h"
+#include "power.h"
+
+/* Power down stops the oscillator and timer0 with it: no display, no
+ * tick. What wakes us:
+ *  - INT4, a falling edge on P3.0. That is RXD, and S2 as well. The
+ *    oscillator needs some 3 ms to come back, a byte that comes in
+ *    before that is lost: uart.c puts a preamble in front of a frame
+ *    after a quiet line for it.
+ *  - the power down wake up timer, every WKT_PERIOD. S3 has no
+ *    interrupt, so we look at it and go back down if it is up.
+ * The DS1302 keeps counting, the tick is moved on by the seconds it
+ * counted meanwhile. We go down right after its seconds roll over, so
+ * the whole seconds start at an edge. The part of a second after the
+ * last edge comes from the wake up timer: at each of its wake ups we
+ * look whether the seconds rolled over, so the last edge is known to a
+ * WKT_PERIOD. Its RC is off by some percent, on the part of a second
+ * only. Waiting for the edge after the wake up would be exact, but a
+ * byte or a press that woke us would wait up to a second with it. */
+#define INT_CLKO_EX4    0x40
+#define WKT_HZ          2048            // its own 32 kHz RC / 16
+#define WKT_PERIOD      (WKT_HZ / 10)   // 100ms
+#define WKTCH_WKTEN     0x80
+#define OSC_START_MS    3               // for the oscillator
+#define WKT_MS          ((WKT_PERIOD * 1000UL + WKT_HZ / 2) / WKT_HZ + OSC_START_MS)
+
+static volatile __bit woken;
+
+static bool stay_up(void)
+{
+    return woken || !SW3 || !SW1;
+}
+
+void power_int4_isr(void) __interrupt(16)
+{
+    woken = 1;
+}
+
+bool power_down(void)
+{
+    uint32_t from, to;
+    uint8_t sec, last, edges = 0;
+    uint16_t part = 0;     // ms
+
+    woken = 0;
+    INT_CLKO |= INT_CLKO_EX4;
+    /* Up to a second more with the display on, unless something
+     * comes up meanwhile */
+    last = ds_readbyte(DS_ADDR_SECONDS);
+    do {
+        if (stay_up()) {
+            INT_CLKO &= ~INT_CLKO_EX4;
+            return false;
+        }
+        POWER_IDLE_UNLESS(woken);
+        sec = ds_readbyte(DS_ADDR_SECONDS);
+    } while (sec == last);
+    last = sec;
+    from = ds_daytime();
+
+    /* A lit digit or the buzzer would stay on */
+    TR0 = 0;
+    LED_DIGITS_OFF();
+    BUZZER_OFF;
+    ADC_CONTR = 0;      // the timer interrupt powers it up again
+
+    WKTCL = (WKT_PERIOD - 1) & 0xFF;
+    WKTCH = WKTCH_WKTEN | (WKT_PERIOD - 1) >> 8;
+    while (1) {
+        /* Same as POWER_IDLE_UNLESS(): an edge after the look at
+         * woken wakes us right away */
+        EA = 0;
+        if (woken) {
+            EA = 1;
+        } else {
+            EA = 1;
+            CPU_STOP(PCON_PD);
+        }
+        if (stay_up())
+            break;
+        /* A whole period went by, the edge was somewhere in it */
+        sec = ds_readbyte(DS_ADDR_SECONDS);
+        if (sec != last) {
+            last = sec;
+            edges++;
+            part = WKT_MS / 2;
+        } else {
+            part += WKT_MS;
+        }
+    }
+    WKTCH = 0;
+    INT_CLKO &= ~INT_CLKO_EX4;
+    TR0 = 1;
+
+    /* Then part of one up to now, maybe with the last edge in it */
+    to = ds_daytime();
+    if (to < from)
+        to += DAY_SECONDS;
+    if ((uint8_t)(to - from) != edges)
+        part = WKT_MS / 4;
+    else
+        part += WKT_MS / 2;
+    part += OSC_START_MS;
+    if (part > 999)
+        part = 999;
+    timer0_skip((to - from) * TMO_SECOND + part / 10);
+    return true;
+}
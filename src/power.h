@@ -0,0 +1,29 @@
+#ifndef POWER_H
+#define POWER_H
+
+#include <stdbool.h>
+
+/* STC15 power saving modes, in PCON */
+#define PCON_IDL    0x01    // CPU stops, timers and interrupts go on
+#define PCON_PD     0x02    // oscillator stops, see power_down()
+
+/* Sleep until the next interrupt, unless there is work after all.
+ * Interrupts are off while we look, so one that brings work cannot
+ * slip in between and leave us asleep with it: the 8051 takes none
+ * right after a write to IE, which is the instruction setting IDL. */
+#define POWER_IDLE_UNLESS(work) { \
+        EA = 0; \
+        if (work) { \
+            EA = 1; \
+        } else { \
+            EA = 1; \
+            CPU_STOP(PCON_IDL); \
+        } }
+
+//Display off until a byte comes in or a button is pressed, the tick
+//is moved on by the time slept. False if one came first.
+bool power_down(void);
+
+//Because it is needed in the file containing main
+void power_int4_isr(void) __interrupt(16);
+#endif
@@ -0,0 +1,83 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include "stc15.h"
+#include "timer0.h"
+#include "uart.h"
+#include "buttons.h"
+#include "sched.h"
+#include "util.h"
+#include "ringstat.h"
+
+#ifdef WITH_RING_STATS
+
+/* OPC_STATS on the wire, one byte each:
+ *  DATA0   id of the clock it is about
+ *  DATA1   frames in with a bad checksum or cut short, wraps
+ *  DATA2   frames lost to a full RX queue, wraps
+ *  DATA3   button events lost to a full queue, wraps
+ *  DATA4   longest main loop task, in units of 256 counts (278us)
+ *  DATA5   longest interrupt, in units of 8 counts (9us)
+ * The clock right before us sent its own with CNTR 1, that is the
+ * last of the pass to get here before ours. A frame that got lost
+ * leaves a pass open, PASS_TMO ends it.
+ *
+ * One pass at a time on the ring: a pass puts N frames through the
+ * RX queue of every clock, two of them at once would overrun it. So
+ * no clock starts one until PASS_GAP after the last STATS frame that
+ * went by. */
+#define LOOP_SHIFT      8
+#define ISR_SHIFT       3
+#define PASS_TMO        (10 * TMO_SECOND)
+#define PASS_GAP        (1 * TMO_SECOND)
+
+static __bit pass_open;
+static deadline_t pass_timer;
+static deadline_t ring_quiet;
+
+static void send_own(uint8_t id)
+{
+    uint16_t loop = 0, isr;
+    uint8_t i;
+
+    for (i = 0; i != SCHED_MAX_TASKS; i++)
+        if (sched_worst[i] > loop)
+            loop = sched_worst[i];
+    __critical {
+        isr = isr_worst;
+    }
+    uart1_send_packet(OPC_STATS, id, rx_errors, rx_overruns,
+                      (uint32_t)btn_drops << 16 |
+                      (uint16_t)saturate(loop, LOOP_SHIFT) << 8 |
+                      saturate(isr, ISR_SHIFT));
+}
+
+void ringstat_start(uint8_t id)
+{
+    if (pass_open && !deadline_passed(pass_timer))
+        return;
+    if (!deadline_passed(ring_quiet))
+        return;
+    pass_open = 1;
+    deadline_set(&pass_timer, PASS_TMO);
+    send_own(id);
+}
+
+void ringstat_frame(uint8_t id)
+{
+    deadline_set(&ring_quiet, PASS_GAP);
+    if (pass_open && deadline_passed(pass_timer))
+        pass_open = 0;
+
+    if (pass_open) {
+        /* Ours made it round: the pass ends here */
+        if (rx_hops == 1)
+            pass_open = 0;
+        return;
+    }
+    uart1_send_frame(rx_hops, 0, 0, OPC_STATS, rx_buf[1], rx_buf[2], rx_buf[3],
+                     (uint32_t)rx_buf[4] << 16 | (uint16_t)rx_buf[5] << 8 | rx_buf[6], rx_buf[7]);
+    if (rx_hops == 1 && id != 0xFF)
+        send_own(id);
+}
+
+#endif /* WITH_RING_STATS */
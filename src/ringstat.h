@@ -0,0 +1,22 @@
+#ifndef RINGSTAT_H
+#define RINGSTAT_H
+
+#include <stdint.h>
+
+/* How every clock in the ring is doing, in one go round: a clock
+ * starts a pass with an OPC_STATS frame of its own counters. Each
+ * clock after it sends on what it gets and, once the frame of the
+ * clock right before it went by, adds its own. The frames of the pass
+ * follow each other round the ring until they get back to whoever
+ * started it, so one place on the ring sees the lot. */
+
+#ifdef WITH_RING_STATS
+//Start a pass, unless one is still going round
+void ringstat_start(uint8_t id);
+//The OPC_STATS frame in rx_buf. Without an id, 0xFF, only send it on
+void ringstat_frame(uint8_t id);
+#else
+#define ringstat_start(id)
+#endif /* WITH_RING_STATS */
+
+#endif /* RINGSTAT_H */
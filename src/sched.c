@@ -0,0 +1,60 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include "stc15.h"
+#include "timer0.h"
+#include "sched.h"
+
+uint16_t sched_worst[SCHED_MAX_TASKS];
+uint32_t sched_busy;
+
+/* Next due tick of every task, low byte only: periods are short */
+static uint8_t due[SCHED_MAX_TASKS];
+static uint32_t busy;
+static uint8_t second;
+
+bool sched_run(const struct Task __code *tasks, uint8_t n)
+{
+    uint8_t i, now = time_now;
+    uint16_t start, took;
+
+    /* Once a second hand over the busy time */
+    if ((uint8_t)(now - second) >= TMO_SECOND) {
+        second = now;
+        sched_busy = busy;
+        busy = 0;
+    }
+
+    for (i = 0; i != n; i++, tasks++) {
+        if ((int8_t)(now - due[i]) >= 0 || (tasks->ready && tasks->ready())) {
+            due[i] = now + tasks->period;
+            start = timer0_counts();
+            tasks->run();
+            took = timer0_counts() - start;
+            if (took > sched_worst[i])
+                sched_worst[i] = took;
+            busy += took;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool sched_pending(const struct Task __code *tasks, uint8_t n)
+{
+    uint8_t i, now = time_now;
+
+    for (i = 0; i != n; i++, tasks++) {
+        if ((int8_t)(now - due[i]) >= 0 || (tasks->ready && tasks->ready()))
+            return true;
+    }
+    return false;
+}
+
+void sched_restart(void)
+{
+    uint8_t i, now = time_now;
+
+    for (i = 0; i != SCHED_MAX_TASKS; i++)
+        due[i] = now;
+    second = now;
+}
@@ -0,0 +1,33 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Run to completion scheduler for the main loop.
+ *
+ * A task runs when its period is up, or as soon as its ready() says
+ * there is work for it. Each pass runs the first task in the table
+ * that is due, so the ones on top wait the least: a task lower down
+ * only gets a turn when nothing above it has work. */
+struct Task {
+    void (*run)(void);
+    bool (*ready)(void);    // NULL: only by period
+    uint8_t period;         // ticks, 1..127
+};
+
+#define SCHED_MAX_TASKS 8
+
+//Run one task, false if none was due: the CPU has nothing to do
+bool sched_run(const struct Task __code *tasks, uint8_t n);
+//True if sched_run() would run a task
+bool sched_pending(const struct Task __code *tasks, uint8_t n);
+//All tasks due now, after the tick jumped
+void sched_restart(void);
+
+/* Longest run of each task so far, timer0 counts (FOSC / 12) */
+extern uint16_t sched_worst[SCHED_MAX_TASKS];
+/* Counts spent in tasks during the last second, of FOSC / 12 */
+extern uint32_t sched_busy;
+
+#endif /* SCHED_H */
@@ -1,6 +1,11 @@
 #ifndef _STC15_H_
 #define _STC15_H_
 
+#ifdef __GNUC__
+/* Host build: the SFRs are plain variables owned by the simulator (sim/) */
+#include "sim_hal.h"
+#else
+
 #include <8051.h>
 
 #ifdef REG8051_H
@@ -175,5 +180,10 @@ __sfr __at 0xf7 PWMFDCR;
 #define PWM7T2L     (*(unsigned char volatile xdata *)0xff53)
 #define PWM7CR      (*(unsigned char volatile xdata *)0xff54)
 
-#endif
+/* Setting IDL or PD in PCON stops the CPU right there, the datasheet
+ * wants a couple of NOPs behind it for the wake up */
+#define CPU_STOP(mode)  { PCON |= (mode); __asm nop __endasm; __asm nop __endasm; }
 
+#endif /* __GNUC__ */
+
+#endif
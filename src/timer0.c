@@ -1,53 +1,209 @@
 #include <stdint.h>
 #include "stc15.h"
+#include "hwconfig.h"
 #include "timer0.h"
+#include "adc.h"
+#include "buttons.h"
 
-volatile uint8_t time_now;
+volatile uint32_t tick_count;
 
-/* Keep calling this function to make sure
- * the timer stays elapsed */
-bool timer_elapsed(uint8_t *timer)
+/* Every slot adds tick_step to tick_phase, each carry out of it is
+ * a tick. So tick_step is ticks per slot in units of 2^-32, which
+ * allows any rate, not just whole numbers of slots per tick. */
+static uint32_t tick_phase;
+static uint32_t tick_step;
+static volatile uint16_t slot_count;
+#ifdef WITH_JOURNAL
+static uint16_t lost_counts;    // short of a slot, for next time
+#endif
+
+/* Counts a digit is lit per slot, roughly 1.6 times more each level.
+ * Neither part of a slot gets shorter than 64 counts, 70us, so the
+ * interrupt is done with one before the next comes. */
+static const uint16_t __code level_on[DISPLAY_LEVELS] = {
+    64, 96, 160, 256, 448, 768, 1216, TIMER0_COUNTS - 64
+};
+static volatile uint8_t level = DISPLAY_LEVEL_DEFAULT;
+static uint16_t slot_on;        // lit part of the current slot
+static uint8_t digit;
+static __bit lit;
+
+/* For timer0_counts(): every interrupt starts a part, the timer
+ * counts up from the reload value written the interrupt before */
+volatile uint16_t timer0_part_start;    // timer0_counts() at its start
+volatile uint16_t timer0_part_reload;   // its reload value
+static uint16_t next_reload;    // the reload of the part after
+static uint16_t slot_start;     // timer0_counts() when the slot began
+volatile uint16_t isr_worst;
+
+/* Read until two reads agree: the ISR only ticks every 10ms,
+ * so this takes a second go once in a long while */
+uint32_t ticks_now(void)
 {
-    uint8_t t = *timer;
-    t -= time_now;
-    if(t > 0x80)
-    {
-        *timer = time_now - 1;
-        return true;
-    }
-    return false;
+    uint32_t t;
+    do {
+        t = tick_count;
+    } while (t != tick_count);
+    return t;
 }
 
+/* With the timer running TL0/TH0 only set the reload, which the
+ * timer picks up at the next overflow. So each interrupt sets the
+ * length of the part after the one it starts. */
+#define TIMER0_RELOAD(counts) { \
+        next_reload = 0x10000 - (counts); \
+        TL0 = next_reload & 0xFF; \
+        TH0 = next_reload >> 8; }
+
 /*
-  interrupt: every 0.1ms=100us come here
+  interrupt: every slot, 500 times a second, come here twice
 
-  Check button status
-  Dynamically LED turn on
+  Check the move button
+  Dynamically LED turn on, and off again
  */
-void timer0_isr() __interrupt 1 __using 1
+void timer0_isr(void) __interrupt(1) __using(1)
+{
+    timer0_part_start -= timer0_part_reload;   // + the part that ended
+    timer0_part_reload = next_reload;
+
+    if (!lit) {
+        /* A new picture only ever starts with a frame */
+        if (!digit && dbuf_swap) {
+            dbuf_show ^= 4;
+            dbuf_swap = 0;
+        }
+        LED_SEGMENT_PORT = dbuf[dbuf_show + digit];
+        LED_DIGIT_ON(digit);
+        lit = 1;
+        if (!digit)
+            ADC_KICK();                         // a sample every frame
+        TIMER0_RELOAD(TIMER0_COUNTS - slot_on); // then dark for the rest
+
+        slot_count++;
+        slot_start = timer0_part_start;
+        /* Carry out means 10 ms passed */
+        tick_phase += tick_step;
+        if(tick_phase < tick_step)
+            tick_count++;
+    } else {
+        LED_DIGITS_OFF();
+        lit = 0;
+        digit = (digit + 1) & 3;
+        slot_on = level_on[level];
+        TIMER0_RELOAD(slot_on);                 // the next digit lights this long
+    }
+
+    /* Last, so a press goes with the tick this part is in */
+    BUTTONS_SAMPLE_S3(timer0_part_start);
+    ISR_WORST_SINCE(timer0_part_start);
+}
+
+void display_brightness(uint8_t l)
 {
-    static uint8_t ms_10timer = 0;
+    level = l;
+}
 
-    /* Count upto 10 ms */
-    if(++ms_10timer > 100)
-    {
-        ms_10timer = 0;
-        time_now++;
+uint16_t timer0_counts(void)
+{
+    uint16_t start, count;
+    /* Again if an interrupt came in between */
+    do {
+        start = timer0_part_start;
+        TIMER0_COUNTS_ISR(count);
+    } while (start != timer0_part_start);
+    return count;
+}
+
+/* The phase is how far into its tick the slot began, in 1/256 ticks
+ * that is its top byte. One of those is 36 counts. */
+#define COUNTS_PER_FRAC     (FOSC / 12 / TMO_SECOND / 256)
+
+uint32_t ticks_before(uint16_t ago)
+{
+    uint32_t t;
+    uint16_t into;
+    uint8_t frac;
+    int16_t back;
+
+    __critical {
+        t = tick_count;
+        frac = tick_phase >> 24;
+        into = timer0_counts() - slot_start;
+    }
+    /* 1/256 ticks from the start of this tick back to then */
+    back = ago / COUNTS_PER_FRAC - (frac + into / COUNTS_PER_FRAC);
+    if (back <= 0)
+        return t;
+    return t - ((back + 255) >> 8);
+}
+
+uint16_t timer0_slots(void)
+{
+    uint16_t c;
+    do {
+        c = slot_count;
+    } while (c != slot_count);
+    return c;
+}
+
+/* tick_step = 2^32 * ticks / slots, by long division as it does not fit
+ * 32 bits otherwise. Needs ticks < slots. */
+void timer0_set_rate(uint32_t ticks, uint32_t slots)
+{
+    uint32_t step = 0;
+    for(uint8_t i = 0; i < 32; i++) {
+        ticks <<= 1;
+        step <<= 1;
+        if(ticks >= slots) {
+            ticks -= slots;
+            step |= 1;
+        }
+    }
+    __critical {
+        tick_step = step;
+    }
+}
+
+void timer0_skip(uint32_t ticks)
+{
+    __critical {
+        tick_count += ticks;
+    }
+}
+
+#ifdef WITH_JOURNAL
+/* The one interrupt that waited through it still comes, and counts a
+ * slot every other time. Only a flash erase of the journal takes
+ * that long. */
+void timer0_lost(uint16_t counts)
+{
+    lost_counts += counts - TIMER0_COUNTS / 2;
+    __critical {
+        while (lost_counts >= TIMER0_COUNTS) {
+            lost_counts -= TIMER0_COUNTS;
+            slot_count++;
+            tick_phase += tick_step;
+            if (tick_phase < tick_step)
+                tick_count++;
+        }
     }
 }
+#endif /* WITH_JOURNAL */
 
-// Call timer0_isr() 10000/sec: 0.0001 sec
-// Initialize the timer count so that it overflows after 0.0001 sec
-// THTL = 0x10000 - FOSC / 12 / 10000 = 0x10000 - 92.16 = 65444 = 0xFFA4
-// When 11.0592MHz clock case, set every 100us interruption
-void timer0_init(void)		//100us @ 11.0592MHz
+// Start with a slot of TIMER0_COUNTS: 1843 counts of FOSC / 12 = 2ms
+// THTL = 0x10000 - FOSC / 12 / 500 = 0x10000 - 1843.2 = 63693 = 0xF8CD
+// When 11.0592MHz clock case, a slot every 2ms, 500 a second
+void timer0_init(void)		//2ms @ 11.0592MHz
 {
     // refer to section 7 of datasheet: STC15F2K60S2-en2.pdf
     // TMOD = 0;    // default: 16-bit auto-reload
     // AUXR = 0;    // default: traditional 8051 timer frequency of FOSC / 12
     // Initial values of TL0 and TH0 are stored in hidden reload registers: RL_TL0 and RL_TH0
-    TL0 = 0xA4;		// Initial timer value
-    TH0 = 0xFF;		// Initial timer value
+    slot_on = level_on[level];
+    TIMER0_RELOAD(slot_on);     // Initial timer value
+    timer0_part_reload = next_reload;
+    // That is 500.03 not 500 slots a second
+    timer0_set_rate(TMO_SECOND * TIMER0_COUNTS * 12UL, FOSC);
     TF0 = 0;		// Clear overflow flag
     TR0 = 1;		// Timer0 start run
     ET0 = 1;        // Enable timer0 interrupt
@@ -4,7 +4,13 @@
 #include <stdbool.h>
 #include <stdint.h>
 
-/* A overflowing counter couting in steps of 10ms
+/* Ticks of 10ms since power up. It takes 497 days to wrap, so for
+ * anything the clock does it only goes up. Read it with ticks_now(),
+ * the ISR may change it halfway a multi byte read. */
+extern volatile uint32_t tick_count;
+uint32_t ticks_now(void);
+
+/* The low byte of it, a single byte read needs no care.
  * Bit 0 = 10ms
  * Bit 1 = 20ms
  * Bit 2 = 40ms
@@ -17,20 +23,100 @@
 #define TICK_320MS  (1<<5)
 #define TICK_640MS  (1<<6)
 #define TICK_1280MS  (1<<7)
-extern volatile uint8_t time_now;
+#define time_now ((uint8_t)tick_count)
+/* Timer0 multiplexes the display: every digit gets a slot of this
+ * many counts of FOSC / 12, 2 ms, so all four refresh at 125 Hz. A
+ * slot takes two interrupts, one lights the digit and one turns it
+ * off again, as far into the slot as the brightness says. The tick is
+ * counted in slots. */
+#define TIMER0_COUNTS   1843
+#define TIMER0_HZ       (FOSC / 12 / TIMER0_COUNTS)    // slots
+
 void timer0_init(void);
-#ifndef __GNUC__
-void timer0_isr() __interrupt 1 __using 1;
+void timer0_isr(void) __interrupt(1) __using(1);
+//Slots so far, wraps
+uint16_t timer0_slots(void);
+//Counts of FOSC / 12 so far, wraps every 71ms: for timing code
+uint16_t timer0_counts(void);
+/* The tick it was ago counts of the above back, the one the time
+ * falls in to within 1/256 tick, for times that come with a frame */
+uint32_t ticks_before(uint16_t ago);
+
+/* timer0_counts() for the other interrupts, as long as they do not
+ * run at a higher priority than timer0: an ISR can not call what the
+ * main loop calls as well, sdcc keeps the locals at fixed addresses. */
+extern volatile uint16_t timer0_part_start;
+extern volatile uint16_t timer0_part_reload;
+#ifdef __GNUC__
+/* Host build: the ring simulator runs the counter, see hal.c */
+#define TIMER0_COUNTS_ISR(c) { \
+        c = timer0_part_start + (hal_timer0_count() - timer0_part_reload); }
+#else
+#define TIMER0_COUNTS_ISR(c) { \
+        uint8_t hi_, lo_; \
+        do { \
+            hi_ = TH0; \
+            lo_ = TL0; \
+        } while (hi_ != TH0);   /* TL0 carried into TH0 */ \
+        c = timer0_part_start + ((uint16_t)(hi_ << 8 | lo_) - timer0_part_reload); }
+#endif
+/* Longest any interrupt took so far, in counts: timer0 from the
+ * overflow on, so with the time it waited, the UART from its entry
+ * on. A timer0 overflow that waits behind an ISR throws the count off
+ * by a part, such figures are left out. */
+extern volatile uint16_t isr_worst;
+#define ISR_WORST_SINCE(start) { \
+        uint16_t t_; \
+        TIMER0_COUNTS_ISR(t_); \
+        t_ -= (start); \
+        if (t_ > isr_worst && t_ < TIMER0_COUNTS) \
+            isr_worst = t_; }
+//Count this many ticks per that many slots
+void timer0_set_rate(uint32_t ticks, uint32_t slots);
+//Move the tick on, for time the timer was stopped
+void timer0_skip(uint32_t ticks);
+#ifdef WITH_JOURNAL
+//Count the slots of that many counts the interrupt did not get to
+void timer0_lost(uint16_t counts);
 #endif
 
-bool timer_elapsed(uint8_t *timer);
+/* Segments to scan out, see led.h */
+extern uint8_t dbuf[8];
+extern volatile uint8_t dbuf_show;
+extern volatile __bit dbuf_swap;
+#define DISPLAY_LEVELS          8
+#define DISPLAY_LEVEL_DEFAULT   5   // what the old 4 out of 9 scan gave
+//0 is dimmest, takes effect from the next slot
+void display_brightness(uint8_t level);
 
 #define TMO_10MS 1
 #define TMO_100MS 10
 #define TMO_SECOND 100
-static inline void set_timer(uint8_t *timer, uint8_t tmo)
+
+/* Deadlines are absolute tick counts, so a deadline stays passed
+ * however long nobody looks at it */
+typedef uint32_t deadline_t;
+
+static inline void deadline_set(deadline_t *d, uint32_t tmo)
+{
+    *d = ticks_now() + tmo;
+}
+
+/* For periodic work: the next period counts from the last deadline,
+ * not from whenever we got round to it, so it does not drift */
+static inline void deadline_advance(deadline_t *d, uint32_t period)
+{
+    *d += period;
+}
+
+static inline bool deadline_passed(deadline_t d)
+{
+    return (int32_t)(ticks_now() - d) >= 0;
+}
+
+static inline uint32_t ticks_since(uint32_t t)
 {
-    *timer = time_now + tmo;
+    return ticks_now() - t;
 }
 
 #endif /* TIMER0_H */
@@ -0,0 +1,25 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+/* Instrumentation points for the host ring simulator (sim/ringsim.c).
+ * On the target TRACE() compiles to nothing, arguments included. */
+enum TraceEvent {
+    TRACE_STATE,        // arg: statemachine state, every pass
+    TRACE_CLOCK_START,  // arg: own remaining time in ms, counting starts
+    TRACE_CLOCK_STOP,   // arg: own remaining time in ms, move handed on
+    TRACE_TX_FRAME,     // arg: opcode of a frame going onto the wire
+    TRACE_RX_ERROR,     // arg: opcode of a frame with a bad checksum or cut short
+    TRACE_CLAIM_SENT,   // arg: 0, own CLAIM handed to the uart
+    TRACE_CLAIM_BACK,   // arg: 0, own CLAIM came back round the ring
+};
+
+#ifdef __GNUC__
+void hal_trace(uint8_t ev, uint32_t arg);
+#define TRACE(ev, arg) hal_trace(ev, arg)
+#else
+#define TRACE(ev, arg)
+#endif
+
+#endif /* TRACE_H */
@@ -1,45 +1,327 @@
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include "stc15.h"
 
 #include "uart.h"
+#include "timer0.h"
+#include "trace.h"
 
 /* Protocol on the wire:
  * 1 byte SYNC
- * 1 byte CNTR //Debug aid
+ * 1 byte CNTR //Hops the frame made, 1 from the clock that sent it
+ * 1 byte AGE
  * 1 byte OPC
  * 1 byte DATA0
  * 1 byte DATA1
  * 1 byte DATA2
  * 1 byte DATA3
  * 1 byte DATA4
+ * 1 byte DATA5
+ * 1 byte DATA6
+ * 1 byte LATE_H
+ * 1 byte LATE_L
  * 1 byte CHECKSUM
  *
- * This is a total of 9 bytes.
+ * This is a total of 14 bytes. DATA3..5 is a time in 10ms ticks,
+ * most significant byte first. CHECKSUM is a CRC-8 over OPC, DATA0..6
+ * and LATE, which the ISR works out a byte at a time as they come in
+ * and go out, so no byte takes longer than another.
+ *
+ * SYNC only ever starts a frame: any byte after it that is SYNC or
+ * ESC goes out as ESC and the byte XOR ESC_FLIP, so a frame may take
+ * up to 27 bytes on the line. A SYNC inside a frame, or a gap of more
+ * than RX_GAP_TICKS, means the frame broke off: it is dropped and
+ * counted with the bad checksums, the SYNC starts the next one. A lost
+ * byte costs the frame it was in, not the ones after it.
+ *
+ * AGE is how long ago what the frame tells of happened, in AGE_UNITs:
+ * the press behind a handoff, say. Like CNTR it is not part of the
+ * checksum, as every clock puts in its own: the age the frame came in
+ * with, plus the time it took on the wire, plus how long it sat in
+ * this clock. The receiver places the event that far back in its own
+ * time, so the time a frame spends on the way round is nobody's. The
+ * ISR takes both ends from timer0, no clock has to agree with another
+ * on what time it is. AGE_OLD is that old or older.
+ *
+ * A frame sent again, long after what it tells of, goes out with the
+ * AGE of a new one and LATE on top of that: 10ms ticks, as many as fit
+ * in 16 bits. It is part of the packet, the clocks that pass the
+ * frame on leave it as it is.
+ *
+ * CLAIM and LINK frames of another clock are cut through: once OPC and DATA0
+ * are in, we start sending the frame on while the rest is still coming
+ * in. The frame is still handed to the main loop, flagged with
+ * rx_forwarded, so it can keep its bookkeeping without sending it again.
+ *
+ * Received frames go into a ring of RX_QUEUE_LEN slots. The ISR fills
+ * the slot at rx_head and only then moves rx_head on, the main loop
+ * copies out the slot at rx_tail and only then moves rx_tail on. Both
+ * are single bytes, so neither side has to lock out the other. Both
+ * rings sit in the 256 bytes of on-chip XRAM, which leaves idata to
+ * the stack.
+ *
+ * Sending works the same way the other way round: uart1_send_packet()
+ * fills the slot at tx_head of the TX ring, the TX interrupt sends the
+ * frames from tx_tail on, one after the other.
+ *
+ * Line rate: every clock starts at 9600. Once the ring is assigned the
+ * master steps it up one rate at a time with BAUD frames (DATA0 is the
+ * step, DATA1 the rate index):
+ *  PROPOSE  sent on at the old rate, after that each clock switches
+ *  TEST     must come back round at the new rate with a good checksum
+ *  COMMIT   the new rate is the one to go back to from now on
+ * A clock that does not see the COMMIT in time goes back by itself, a
+ * failed step ends the negotiation. When the rate is up and the line
+ * gets noisy (bad checksums, bytes between frames) a clock drops to
+ * 9600 and sends FALLBACK: it is garbage to the next clock, which
+ * then drops as well, until the whole ring is back at 9600.
+ *
+ * A clock in power down loses the bytes that wake it up (power.c).
+ * With uart1_wake_next set, a frame after WAKE_QUIET without sending
+ * gets WAKE_PREAMBLE_MS worth of WAKE_BYTEs in front of it, which everybody
+ * skips between frames. The clock after us only goes down after a
+ * longer quiet spell than that.
 */
 
 #define SYNC_BYTE 's'
+#define ESC_BYTE  0x7D
+#define ESC_FLIP  0x20
+#define WAKE_BYTE 0xFF  // only the start bit is low
+#define WAKE_PREAMBLE_MS 4
+#define WAKE_QUIET       (5 * TMO_SECOND)
 enum ISR_STATE {
     ISR_STATE_SYNC,
     ISR_STATE_CNTR,
+    ISR_STATE_AGE,
     ISR_STATE_OPC,
     ISR_STATE_DATA0,
     ISR_STATE_DATA1,
     ISR_STATE_DATA2,
     ISR_STATE_DATA3,
     ISR_STATE_DATA4,
+    ISR_STATE_DATA5,
+    ISR_STATE_DATA6,
+    ISR_STATE_LATE_H,
+    ISR_STATE_LATE_L,
     ISR_STATE_CHECKSUM,
 };
 
-#define BAUDRATE 9600 // serial port speed
+/* Timer2 reload for each line rate, at sysclk/1 */
+#define BAUD_RELOAD(b)  (65536 - (FOSC / 4 / (b)))
+static const uint16_t __code baud_reload[] = {
+    BAUD_RELOAD(9600),
+    BAUD_RELOAD(19200),
+    BAUD_RELOAD(38400),
+    BAUD_RELOAD(57600),
+    BAUD_RELOAD(115200),
+};
+#define BAUD_RATES      ((uint8_t)(sizeof(baud_reload) / sizeof(baud_reload[0])))
+
+/* Preamble length at each rate, 10 bits a byte */
+#define WAKE_BYTES(b)   ((b) / 10 * WAKE_PREAMBLE_MS / 1000 + 1)
+static const uint8_t __code wake_bytes[] = {
+    WAKE_BYTES(9600),
+    WAKE_BYTES(19200),
+    WAKE_BYTES(38400),
+    WAKE_BYTES(57600),
+    WAKE_BYTES(115200),
+};
+
+/* Counts of timer0_counts() a byte of 10 bits takes on the line */
+#define BYTE_COUNTS(b)  (FOSC / 12 * 10 / (b))
+static const uint16_t __code byte_counts[] = {
+    BYTE_COUNTS(9600),
+    BYTE_COUNTS(19200),
+    BYTE_COUNTS(38400),
+    BYTE_COUNTS(57600),
+    BYTE_COUNTS(115200),
+};
+
+#define AGE_UNIT    256         // counts, 278us
+#define AGE_OLD     0xFF
+
+/* CRC-8, x^8 + x^2 + x + 1, a nibble at a time: the table has what
+ * the top nibble leaves after four shifts. Seeded with SYNC_BYTE, so
+ * a frame of all zeros does not check out. */
+static const uint8_t __code crc_nibble[16] = {
+    0x00, 0x07, 0x0E, 0x09, 0x1C, 0x1B, 0x12, 0x15,
+    0x38, 0x3F, 0x36, 0x31, 0x24, 0x23, 0x2A, 0x2D,
+};
+#define CRC_INIT    SYNC_BYTE
+#define CRC_ADD(crc, b) { \
+        crc ^= (b); \
+        crc = crc << 4 ^ crc_nibble[crc >> 4]; \
+        crc = crc << 4 ^ crc_nibble[crc >> 4]; }
+
+enum BaudStep {
+    BAUD_PROPOSE,
+    BAUD_TEST,
+    BAUD_COMMIT,
+    BAUD_FALLBACK,
+    BAUD_SETTLE,        // master only: wait for the others to go back
+};
+
+#define BAUD_TRIAL_TMO  (150 * TMO_10MS)   // fits a 64 clock ring at 9600
+#define BAUD_ERR_LIMIT  8
+
+static uint8_t baud_cur;                // rate the line runs at
+static volatile uint8_t baud_next;      // switch to this once TX is idle
+static uint8_t baud_committed;          // rate to go back to
+static __bit baud_trial;                // running at a rate not committed
+static uint8_t baud_try;                // master: rate being tried, 0 = done
+static enum BaudStep baud_step;         // master: what we wait for
+static deadline_t baud_timer;
+static volatile uint8_t line_errors;    // leaky count of rx errors
+
+/* Stop T2 while reloading it. What went wrong at the old rate says
+ * nothing about the new one. */
+#define BAUD_APPLY() { \
+        AUXR &= ~0x10; \
+        T2L = baud_reload[baud_next] & 0xFF; \
+        T2H = baud_reload[baud_next] >> 8; \
+        AUXR |= 0x10; \
+        baud_cur = baud_next; \
+        line_errors = 0; }
+
+#ifndef RX_QUEUE_LEN
+#define RX_QUEUE_LEN 4 // power of 2
+#endif
+#define RX_FLAGS        MAX_PACKET_SIZE // slot byte after the packet:
+#define RX_FLAG_FWD     (1<<7)          // .. this and the CNTR it had
+#define RX_HOPS         0x7F
+/* After that in both queues: timer0_counts() when what the frame tells
+ * of happened, low byte first */
+#define SLOT_STAMP      (MAX_PACKET_SIZE + 1)
+/* Then in the RX queue the AGE it came with and the low byte of the
+ * tick: the stamp wraps every 71ms, this tells when a packet waited
+ * longer than that */
+#define RX_AGE          (MAX_PACKET_SIZE + 3)
+#define RX_TICK         (MAX_PACKET_SIZE + 4)
+#define RX_STALE_TICKS  (6 * TMO_10MS)    // 60ms
+/* No byte for longer than this inside a frame and it broke off. More
+ * than a sector erase holds up the clock before us, see eeprom.h */
+#define RX_GAP_TICKS    (3 * TMO_10MS)
+/* In the TX queue the slot byte after the packet is the hops it made
+ * before us, 0 for our own */
+#define TX_HOPS         MAX_PACKET_SIZE
+#define TX_OLD          (1<<7)
 
 uint8_t rx_buf[MAX_PACKET_SIZE];
-volatile __bit rx_packet_available = 0;
+__bit rx_forwarded = 0;
+uint8_t rx_hops;
+uint8_t uart1_forward_id = 0xFF;
+volatile uint8_t rx_overruns;
+volatile uint8_t rx_errors;
+
+static __xdata uint8_t rx_queue[RX_QUEUE_LEN + 1][MAX_PACKET_SIZE + 5]; // +1 scratch
+static volatile uint8_t rx_head, rx_tail;
+static uint8_t __xdata *rx_slot = rx_queue[0];
+/* Of the packet in rx_buf */
+static uint16_t rx_stamp;
+static uint8_t rx_age;
+static uint8_t rx_tick;
+
+#ifndef TX_QUEUE_LEN
+#define TX_QUEUE_LEN 4 // power of 2
+#endif
+
+volatile uint8_t tx_drops;
 
 static volatile uint8_t tx_busy = 0;
-static uint8_t tx_buf[MAX_PACKET_SIZE + 1]; //+1 for checksum
+static __xdata uint8_t tx_queue[TX_QUEUE_LEN][MAX_PACKET_SIZE + 3]; //+hops, stamp
+static volatile uint8_t tx_head, tx_tail;
+static uint8_t __xdata *tx_slot;
 static enum ISR_STATE isr_tx_state;
+static enum ISR_STATE isr_rx_state = ISR_STATE_SYNC;
+static uint8_t rx_crc, tx_crc;
+static __bit rx_esc = 0;                // last byte in was ESC
+static uint8_t rx_byte_tick;            // time_now then
+static __bit tx_stuff = 0;              // tx_stuffed goes out next
+static uint8_t tx_stuffed;
+
+__bit uart1_wake_next = 0;
+static __bit tx_wake = 0;               // next frame gets a preamble
+static uint8_t tx_preamble;             // preamble bytes still to go
+static volatile uint8_t tx_frames;      // frames started, wraps
+static uint8_t tx_seen;
+static deadline_t tx_quiet;
+
+/* Cut-through: the frame as it came off the wire and how far
+ * we got sending it on. */
+static uint8_t fwd_buf[ISR_STATE_CHECKSUM + 1];
+static uint8_t fwd_rx, fwd_tx;
+static volatile __bit fwd_active = 0;
+
+#define TX_BYTE(b)  { SBUF = (b); tx_busy = 1; }
+
+/* Any byte after SYNC: SYNC and ESC go out as ESC and the byte with
+ * ESC_FLIP, the TX interrupt sends the second one */
+#define TX_PUT(b) { \
+        uint8_t p_ = (b); \
+        if (p_ == SYNC_BYTE || p_ == ESC_BYTE) { \
+            tx_stuffed = p_ ^ ESC_FLIP; \
+            tx_stuff = 1; \
+            p_ = ESC_BYTE; \
+        } \
+        TX_BYTE(p_); }
+
+/* Packet byte i of a frame, into the CRC on the way */
+#define RX_DATA(i) { \
+        CRC_ADD(rx_crc, rx_byte); \
+        rx_slot[i] = rx_byte; \
+        isr_rx_state++; }
+#define TX_DATA(i) { \
+        uint8_t b_ = tx_slot[i]; \
+        CRC_ADD(tx_crc, b_); \
+        TX_PUT(b_); \
+        isr_tx_state++; }
+
+/* AGE for what happened at stamp, going out ahead counts from now */
+#define AGE_BYTE(b, stamp, old, ahead) { \
+        uint16_t a_; \
+        TIMER0_COUNTS_ISR(a_); \
+        a_ += (ahead) - (stamp); \
+        b = (old) || a_ >= AGE_OLD * AGE_UNIT - AGE_UNIT / 2 ? \
+            AGE_OLD : (a_ + AGE_UNIT / 2) / AGE_UNIT; }
+
+#define SLOT_GET_STAMP(slot) \
+        ((slot)[SLOT_STAMP] | (uint16_t)(slot)[SLOT_STAMP + 1] << 8)
+
+/* First byte of a frame, the rest follows from the TX interrupt */
+#define TX_START() { \
+        tx_frames++; \
+        if (tx_wake) { \
+            tx_wake = 0; \
+            tx_preamble = wake_bytes[baud_cur]; \
+            TX_BYTE(WAKE_BYTE); \
+        } else { \
+            TX_BYTE(SYNC_BYTE); \
+        } }
+
+/* The next frame in the TX queue, if there is one */
+#define TX_NEXT() { \
+        if (tx_tail != tx_head) { \
+            tx_slot = tx_queue[tx_tail & (TX_QUEUE_LEN - 1)]; \
+            isr_tx_state = ISR_STATE_CNTR; \
+            TX_START(); \
+        } }
+
+/* The frame coming in broke off: what we have of it is lost. A cut
+ * through stops where it is, the next clock finds it broken off as
+ * well. */
+#define RX_ABORT() { \
+        TRACE(TRACE_RX_ERROR, rx_slot[0]); \
+        rx_errors++; \
+        line_errors += 4; \
+        isr_rx_state = ISR_STATE_SYNC; \
+        rx_esc = 0; \
+        if (fwd_active) { \
+            fwd_active = 0; \
+            if (!tx_busy) \
+                TX_NEXT(); \
+        } }
 
 void uart1_init(void)
 {
@@ -50,8 +332,8 @@ void uart1_init(void)
     //  10    Using P3_6.
     //P_SW1 |= (1 << 6);          // move UART1 pins -> P3_6:rxd, P3_7:txd
     // UART1 use Timer2
-    T2L = (65536 - (FOSC / 4 / BAUDRATE)) & 0xFF;
-    T2H = (65536 - (FOSC / 4 / BAUDRATE)) >> 8;
+    T2L = baud_reload[0] & 0xFF;
+    T2H = baud_reload[0] >> 8;
     SM1 = 1;                    // serial mode 1: 8-bit async
     AUXR |= 0x14;               // T2R: run T2, T2x12: T2 clk src sysclk/1
     AUXR |= 0x01;               // S1ST2: T2 is baudrate generator
@@ -59,47 +341,119 @@ void uart1_init(void)
     REN = 1;
 }
 
-static uint8_t calc_checksum(const uint8_t *data, uint8_t len)
-{
-    uint8_t checksum = SYNC_BYTE;
-    for(uint8_t i = 0; i < len; i++)
-        checksum += data[i];
-    return checksum;
-}
-
-void uart1_isr() __interrupt 4 __using 2
+void uart1_isr(void) __interrupt(4) __using(2)
 {
     static uint8_t cntr = 0;
+    uint16_t entry;
+
+    TIMER0_COUNTS_ISR(entry);
     /* Receive interrupt */
     if (RI) {
-        static enum ISR_STATE isr_rx_state = ISR_STATE_SYNC;
         RI = 0;                 // clear inta
         /* Read byte from UART */
         uint8_t rx_byte = SBUF;
-        switch(isr_rx_state)
-        {
-            case ISR_STATE_SYNC:
-                if (rx_byte == SYNC_BYTE)
-                    isr_rx_state++;
-                break;
-
-            case ISR_STATE_CNTR:  cntr = rx_byte;      isr_rx_state++; break;
-            case ISR_STATE_OPC:   rx_buf[0] = rx_byte; isr_rx_state++; break;
-            case ISR_STATE_DATA0: rx_buf[1] = rx_byte; isr_rx_state++; break;
-            case ISR_STATE_DATA1: rx_buf[2] = rx_byte; isr_rx_state++; break;
-            case ISR_STATE_DATA2: rx_buf[3] = rx_byte; isr_rx_state++; break;
-            case ISR_STATE_DATA3: rx_buf[4] = rx_byte; isr_rx_state++; break;
-            case ISR_STATE_DATA4: rx_buf[5] = rx_byte; isr_rx_state++; break;
+        /* A SYNC or a long gap inside a frame: the frame broke off,
+         * this byte may start the next one */
+        if (isr_rx_state != ISR_STATE_SYNC &&
+            (rx_byte == SYNC_BYTE || (uint8_t)(time_now - rx_byte_tick) > RX_GAP_TICKS))
+            RX_ABORT();
+        rx_byte_tick = time_now;
+        if (isr_rx_state != ISR_STATE_SYNC && rx_byte == ESC_BYTE) {
+            rx_esc = 1;         // the byte after it is stuffed
+        } else {
+            if (rx_esc)
+                rx_byte ^= ESC_FLIP;
+            fwd_buf[isr_rx_state] = rx_byte;
+            /* Next byte of the frame we are cutting through */
+            if (fwd_active && fwd_rx == isr_rx_state) {
+                fwd_rx++;
+                if (!tx_busy)
+                    TX_PUT(fwd_buf[fwd_tx++]);
+            }
+            switch(isr_rx_state)
+            {
+                case ISR_STATE_SYNC:
+                    if (rx_byte == SYNC_BYTE) {
+                        /* Fill the next free slot, or the scratch one
+                         * if the main loop is that far behind */
+                        if ((uint8_t)(rx_head - rx_tail) < RX_QUEUE_LEN)
+                            rx_slot = rx_queue[rx_head & (RX_QUEUE_LEN - 1)];
+                        else
+                            rx_slot = rx_queue[RX_QUEUE_LEN];
+                        isr_rx_state++;
+                    } else if (rx_byte != WAKE_BYTE) {
+                        line_errors++;  // nothing else should come between frames
+                    }
+                    break;
 
-            case ISR_STATE_CHECKSUM:
-                if(calc_checksum(rx_buf, MAX_PACKET_SIZE) != rx_byte) {
-                    //PANIC MODE?
-                    rx_buf[0] = OPC_PANIC;
+                case ISR_STATE_CNTR:  cntr = rx_byte;       isr_rx_state++; break;
+                case ISR_STATE_AGE: {
+                    /* Back to the event: the age it came with and the
+                     * byte we just waited for, two if it was stuffed */
+                    uint16_t stamp;
+                    TIMER0_COUNTS_ISR(stamp);
+                    stamp -= (rx_esc ? 2 * byte_counts[baud_cur] : byte_counts[baud_cur]) +
+                             (uint16_t)rx_byte * AGE_UNIT;
+                    rx_slot[SLOT_STAMP] = stamp & 0xFF;
+                    rx_slot[SLOT_STAMP + 1] = stamp >> 8;
+                    rx_slot[RX_AGE] = rx_byte;
+                    rx_slot[RX_TICK] = time_now;
+                    isr_rx_state++;
+                    break;
                 }
-                rx_packet_available = 1;
-                //Restart statemachine
-                isr_rx_state = ISR_STATE_SYNC;
-                break;
+                case ISR_STATE_OPC:   rx_crc = CRC_INIT; RX_DATA(0); break;
+                case ISR_STATE_DATA0:
+                    CRC_ADD(rx_crc, rx_byte);
+                    rx_slot[1] = rx_byte;
+                    isr_rx_state++;
+                    /* A claim or link report of someone else: pass it on
+                     * right now, unless the line is in use */
+                    if ((rx_slot[0] == OPC_CLAIM || rx_slot[0] == OPC_LINK) &&
+                        rx_byte != uart1_forward_id &&
+                        uart1_forward_id != 0xFF &&
+                        !tx_busy && tx_tail == tx_head && !fwd_active) {
+                        fwd_buf[ISR_STATE_CNTR] = cntr + 1;
+                        fwd_rx = ISR_STATE_DATA1;
+                        fwd_tx = ISR_STATE_CNTR;
+                        fwd_active = 1;
+                        TRACE(TRACE_TX_FRAME, rx_slot[0]);
+                        TX_START();
+                        /* Its AGE goes out after the preamble, SYNC and CNTR */
+                        AGE_BYTE(fwd_buf[ISR_STATE_AGE], SLOT_GET_STAMP(rx_slot),
+                                 rx_slot[RX_AGE] == AGE_OLD, (tx_preamble + 2) * byte_counts[baud_cur]);
+                    }
+                    break;
+                case ISR_STATE_DATA1: RX_DATA(2); break;
+                case ISR_STATE_DATA2: RX_DATA(3); break;
+                case ISR_STATE_DATA3: RX_DATA(4); break;
+                case ISR_STATE_DATA4: RX_DATA(5); break;
+                case ISR_STATE_DATA5: RX_DATA(6); break;
+                case ISR_STATE_DATA6: RX_DATA(7); break;
+                case ISR_STATE_LATE_H: RX_DATA(8); break;
+                case ISR_STATE_LATE_L: RX_DATA(9); break;
+
+                case ISR_STATE_CHECKSUM:
+                    if(rx_crc != rx_byte) {
+                        //PANIC MODE?
+                        TRACE(TRACE_RX_ERROR, rx_slot[0]);
+                        rx_slot[0] = OPC_PANIC;
+                        rx_errors++;
+                        line_errors += 4;
+                    } else if (line_errors) {
+                        line_errors--;
+                    }
+                    /* A cut through frame goes on with the checksum as
+                     * received, so a broken frame stays broken */
+                    rx_slot[RX_FLAGS] = (fwd_active ? RX_FLAG_FWD : 0) | (cntr & RX_HOPS);
+                    if (rx_slot == rx_queue[RX_QUEUE_LEN])
+                        rx_overruns++;
+                    else
+                        rx_head++;  // hand it to the main loop
+                    //Restart statemachine
+                    isr_rx_state = ISR_STATE_SYNC;
+                    break;
+            }
+            rx_esc = 0;
         }
     }
 
@@ -107,61 +461,338 @@ void uart1_isr() __interrupt 4 __using 2
     if (TI) {
         TI = 0;
         tx_busy = 0;
-        switch(isr_tx_state)
+        if (tx_stuff) {
+            tx_stuff = 0;
+            TX_BYTE(tx_stuffed);
+        } else if (tx_preamble) {
+            /* Its last byte is the SYNC of the frame */
+            TX_BYTE(--tx_preamble ? WAKE_BYTE : SYNC_BYTE);
+        } else if (fwd_active) {
+            /* If we caught up, RX restarts us */
+            if (fwd_tx < fwd_rx)
+                TX_PUT(fwd_buf[fwd_tx++]);
+            /* Done. Its checksum may have gone out from RX, then the
+             * line is free already for what queued up meanwhile */
+            if (fwd_tx > ISR_STATE_CHECKSUM) {
+                fwd_active = 0;
+                if (!tx_busy)
+                    TX_NEXT();
+            }
+        } else switch(isr_tx_state)
         {
             case ISR_STATE_SYNC:
-                //IDLE!
+                //Frame is out, time to change rate if asked to
+                if (baud_next != baud_cur)
+                    BAUD_APPLY();
+                //IDLE! Unless there is a frame in the queue
+                TX_NEXT();
                 break;
 
-            case ISR_STATE_CNTR:  SBUF = cntr + 1;  isr_tx_state++; break;
-            case ISR_STATE_OPC:   SBUF = tx_buf[0]; isr_tx_state++; break;
-            case ISR_STATE_DATA0: SBUF = tx_buf[1]; isr_tx_state++; break;
-            case ISR_STATE_DATA1: SBUF = tx_buf[2]; isr_tx_state++; break;
-            case ISR_STATE_DATA2: SBUF = tx_buf[3]; isr_tx_state++; break;
-            case ISR_STATE_DATA3: SBUF = tx_buf[4]; isr_tx_state++; break;
-            case ISR_STATE_DATA4: SBUF = tx_buf[5]; isr_tx_state++; break;
+            case ISR_STATE_CNTR:
+                TX_PUT((tx_slot[TX_HOPS] & ~TX_OLD) + 1);
+                isr_tx_state++;
+                break;
+            case ISR_STATE_AGE: {
+                uint8_t age;
+                AGE_BYTE(age, SLOT_GET_STAMP(tx_slot), tx_slot[TX_HOPS] & TX_OLD, 0);
+                TX_PUT(age);
+                isr_tx_state++;
+                break;
+            }
+            case ISR_STATE_OPC:   tx_crc = CRC_INIT; TX_DATA(0); break;
+            case ISR_STATE_DATA0: TX_DATA(1); break;
+            case ISR_STATE_DATA1: TX_DATA(2); break;
+            case ISR_STATE_DATA2: TX_DATA(3); break;
+            case ISR_STATE_DATA3: TX_DATA(4); break;
+            case ISR_STATE_DATA4: TX_DATA(5); break;
+            case ISR_STATE_DATA5: TX_DATA(6); break;
+            case ISR_STATE_DATA6: TX_DATA(7); break;
+            case ISR_STATE_LATE_H: TX_DATA(8); break;
+            case ISR_STATE_LATE_L: TX_DATA(9); break;
 
             case ISR_STATE_CHECKSUM:
-                SBUF = tx_buf[MAX_PACKET_SIZE];
+                TX_PUT(tx_crc);
                 isr_tx_state = ISR_STATE_SYNC;
+                tx_tail++;  // slot is free again
                 break;
         }
     }
+    ISR_WORST_SINCE(entry);
+}
+
+/* Change the line rate, right away if the line is idle, otherwise
+ * the TX interrupt does it once the frames in the queue are out.
+ * Until then the errors of a trial that failed do not count either. */
+static void baud_switch(uint8_t rate)
+{
+    __critical {
+        baud_next = rate;
+        line_errors = 0;
+        if (!tx_busy && !fwd_active)
+            BAUD_APPLY();
+    }
+}
+
+static void baud_send(uint8_t step, uint8_t rate)
+{
+    uart1_send_packet(OPC_BAUD, step, rate, 0, 0);
 }
 
-void uart1_send_byte(uint8_t b)
+/* Master: send the next step of the negotiation */
+static void baud_master_send(enum BaudStep step)
 {
-    while(tx_busy);
-    tx_busy = 1;
-    SBUF = b;
+    baud_step = step;
+    baud_send(step, baud_try);
+    deadline_set(&baud_timer, BAUD_TRIAL_TMO);
 }
 
-void uart1_send_packet(uint8_t opc, uint8_t data0, uint8_t data1, uint8_t data2, uint16_t data34)
+static void baud_frame(const uint8_t __xdata *frame)
 {
-    /* Link TX to RX internally */
-    if(0) {
-        rx_buf[0] = opc;
-        rx_buf[1] = data0;
-        rx_buf[2] = data1;
-        rx_buf[3] = data2;
-        rx_buf[4] = data34 >> 8;
-        rx_buf[5] = data34 & 0xFF;
-        rx_packet_available = 1;
+    enum BaudStep step = frame[1];
+    uint8_t rate = frame[2];
+
+    if (baud_try) {
+        /* Master: our own frame made it round */
+        if (step != baud_step || rate != baud_try)
+            return;
+        switch (step) {
+            case BAUD_PROPOSE:
+                baud_trial = 1;
+                baud_switch(rate);
+                baud_master_send(BAUD_TEST);
+                break;
+            case BAUD_TEST:
+                baud_master_send(BAUD_COMMIT);
+                break;
+            case BAUD_COMMIT:
+                baud_trial = 0;
+                baud_committed = rate;
+                if (++baud_try < BAUD_RATES)
+                    baud_master_send(BAUD_PROPOSE);
+                else
+                    baud_try = 0;
+                break;
+            default:
+                break;
+        }
+        return;
+    }
+
+    switch (step) {
+        case BAUD_PROPOSE:
+            if (rate >= BAUD_RATES)
+                break;
+            /* Pass it on at the old rate, then follow */
+            baud_send(step, rate);
+            baud_trial = 1;
+            deadline_set(&baud_timer, BAUD_TRIAL_TMO);
+            baud_switch(rate);
+            break;
+        case BAUD_TEST:
+            baud_send(step, rate);
+            break;
+        case BAUD_COMMIT:
+            baud_send(step, rate);
+            if (baud_trial && rate == baud_cur) {
+                baud_trial = 0;
+                baud_committed = rate;
+            }
+            break;
+        default:
+            /* FALLBACK read cleanly: the ring is back at 9600 */
+            break;
+    }
+}
+
+/* Take the BAUD frames at the head of the queue out of it */
+static void baud_receive(void)
+{
+    uint8_t __xdata *slot;
+
+    while (rx_tail != rx_head) {
+        slot = rx_queue[rx_tail & (RX_QUEUE_LEN - 1)];
+        if (slot[0] != OPC_BAUD)
+            break;
+        baud_frame(slot);
+        rx_tail++;
+    }
+}
+
+void uart1_baud_negotiate(void)
+{
+    if (baud_committed + 1 < BAUD_RATES) {
+        baud_try = baud_committed + 1;
+        baud_master_send(BAUD_PROPOSE);
+    }
+}
+
+void uart1_baud_resume(uint8_t rate)
+{
+    if (rate < BAUD_RATES) {
+        baud_committed = rate;
+        baud_switch(rate);
+    }
+}
+
+bool uart1_baud_busy(void)
+{
+    return baud_try != 0;
+}
+
+uint8_t uart1_baud_index(void)
+{
+    return baud_cur;
+}
+
+void uart1_poll(void)
+{
+    baud_receive();
+
+    /* A frame that broke off with nothing after it */
+    __critical {
+        if (isr_rx_state != ISR_STATE_SYNC &&
+            (uint8_t)(time_now - rx_byte_tick) > RX_GAP_TICKS)
+            RX_ABORT();
+    }
+
+    /* After a quiet spell the next clock may be asleep */
+    if (tx_frames != tx_seen) {
+        tx_seen = tx_frames;
+        deadline_set(&tx_quiet, WAKE_QUIET);
+    } else if (uart1_wake_next && deadline_passed(tx_quiet)) {
+        tx_wake = 1;
+    }
+
+    if (baud_try) {
+        if (deadline_passed(baud_timer)) {
+            if (baud_step == BAUD_SETTLE) {
+                baud_try = 0;
+            } else {
+                /* A step did not make it round, stay where we were
+                 * and give the others time to go back as well */
+                baud_trial = 0;
+                baud_switch(baud_committed);
+                baud_step = BAUD_SETTLE;
+                deadline_set(&baud_timer, BAUD_TRIAL_TMO);
+            }
+        }
+    } else if (baud_trial) {
+        if (deadline_passed(baud_timer)) {
+            baud_trial = 0;
+            baud_switch(baud_committed);
+        }
+    } else if (line_errors > BAUD_ERR_LIMIT) {
+        line_errors = 0;
+        /* Also at 9600: a clock that came back at 9600 into a fast
+         * ring gets the others down this way */
+        baud_committed = 0;
+        baud_switch(0);
+        baud_send(BAUD_FALLBACK, 0);
+    }
+}
+
+bool uart1_pending(void)
+{
+    return rx_tail != rx_head;
+}
+
+uint8_t uart1_arrivals(void)
+{
+    return rx_head;
+}
+
+bool uart1_idle(void)
+{
+    return !tx_busy && !fwd_active && tx_tail == tx_head &&
+           isr_rx_state == ISR_STATE_SYNC && rx_tail == rx_head &&
+           !baud_try && !baud_trial;
+}
+
+uint8_t uart1_peek(void)
+{
+    baud_receive();
+    if (rx_tail == rx_head)
+        return 0;
+    return rx_queue[rx_tail & (RX_QUEUE_LEN - 1)][0];
+}
+
+bool uart1_receive_opc(uint8_t opc)
+{
+    if (uart1_peek() != opc)
+        return false;
+    return uart1_receive();
+}
+
+bool uart1_receive(void)
+{
+    uint8_t __xdata *slot;
+
+    baud_receive();
+    if (rx_tail == rx_head)
+        return false;
+    slot = rx_queue[rx_tail & (RX_QUEUE_LEN - 1)];
+    memcpy(rx_buf, slot, MAX_PACKET_SIZE);
+    rx_forwarded = slot[RX_FLAGS] & RX_FLAG_FWD;
+    rx_hops = slot[RX_FLAGS] & RX_HOPS;
+    rx_stamp = SLOT_GET_STAMP(slot);
+    rx_age = slot[RX_AGE];
+    rx_tick = slot[RX_TICK];
+    rx_tail++;  // slot is the ISR's again
+    return true;
+}
+
+uint16_t uart1_rx_waited(void)
+{
+    if ((uint8_t)(time_now - rx_tick) > RX_STALE_TICKS)
+        return UART1_AGE_MAX;
+    return timer0_counts() - rx_stamp - (uint16_t)rx_age * AGE_UNIT;
+}
+
+uint16_t uart1_rx_age(void)
+{
+    uint16_t waited = uart1_rx_waited();
+    uint16_t age = (uint16_t)rx_age * AGE_UNIT;
+
+    if (rx_age == AGE_OLD || waited >= UART1_AGE_MAX - age)
+        return UART1_AGE_MAX;
+    return waited + age;
+}
+
+uint16_t uart1_rx_late(void)
+{
+    return (uint16_t)rx_buf[8] << 8 | rx_buf[9];
+}
+
+void uart1_send_frame(uint8_t hops, uint16_t age, uint16_t late, uint8_t opc, uint8_t data0, uint8_t data1, uint8_t data2, uint32_t data345, uint8_t data6)
+{
+    uint8_t __xdata *slot;
+    uint16_t stamp = timer0_counts() - age;
+
+    if ((uint8_t)(tx_head - tx_tail) == TX_QUEUE_LEN) {
+        tx_drops++;
+        return;
     }
-    /* Normal code */
-    else
-    {
-        rx_packet_available = 0; //Clear just in case
-        tx_buf[0] = opc;
-        tx_buf[1] = data0;
-        tx_buf[2] = data1;
-        tx_buf[3] = data2;
-        tx_buf[4] = data34 >> 8;
-        tx_buf[5] = data34 & 0xFF;
-        tx_buf[MAX_PACKET_SIZE] = calc_checksum(tx_buf, MAX_PACKET_SIZE);
-        /* Start ISR by sending the first byte */
-        isr_tx_state = ISR_STATE_CNTR;
-        SBUF = SYNC_BYTE;
+    slot = tx_queue[tx_head & (TX_QUEUE_LEN - 1)];
+    slot[0] = opc;
+    slot[1] = data0;
+    slot[2] = data1;
+    slot[3] = data2;
+    slot[4] = data345 >> 16;
+    slot[5] = data345 >> 8;
+    slot[6] = data345 & 0xFF;
+    slot[7] = data6;
+    slot[8] = late >> 8;
+    slot[9] = late & 0xFF;
+    slot[SLOT_STAMP] = stamp & 0xFF;
+    slot[SLOT_STAMP + 1] = stamp >> 8;
+    slot[TX_HOPS] = hops | (age == UART1_AGE_MAX ? TX_OLD : 0);
+    TRACE(TRACE_TX_FRAME, opc);
+    tx_head++;  // the ISR may take it from here
+    __critical {
+        /* If the line is taken the ISR starts ours once the
+         * frames before it are out */
+        if (!fwd_active && !tx_busy)
+            TX_NEXT();
     }
 }
 
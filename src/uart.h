@@ -1,26 +1,82 @@
 #ifndef UART_H
 #define UART_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 enum OPC {
     OPC_ASSIGN = 'A',
     OPC_PASSON = 'P',
+    OPC_BAUD   = 'B', //Line rate negotiation, handled in uart.c
     OPC_CLAIM  = 'C',
+    OPC_LINK   = 'L', //Ring round trip as one clock sees it, see linkstat.h
+    OPC_RESUME = 'R', //A clock that lost the game asks the one before it
+    OPC_STATS  = 'S', //Health of each clock in turn, see ringstat.h
     OPC_PANIC,
 };
 
 /* Packet size is OPC + data bytes */
-#define MAX_PACKET_SIZE 6
+#define MAX_PACKET_SIZE 10
 
-//If this bit is set a new packet is available in RX_BUF
-extern volatile __bit rx_packet_available;
+//Packet last taken from the RX queue by uart1_receive()
 extern uint8_t rx_buf[MAX_PACKET_SIZE];
+//Set along with it if the ISR already sent the packet on
+extern __bit rx_forwarded;
+//Hops it made to get here, from its CNTR
+extern uint8_t rx_hops;
+//Packets dropped because the RX queue was full
+extern volatile uint8_t rx_overruns;
+//Frames that came in with a bad checksum or broke off
+extern volatile uint8_t rx_errors;
+//Packets not sent because the TX queue was full
+extern volatile uint8_t tx_drops;
+//Cut through CLAIMs not for this id, 0xFF disables it
+extern uint8_t uart1_forward_id;
+//The next clock may be in power down: wake it after a quiet line
+extern __bit uart1_wake_next;
 
 void uart1_init(void);
-void uart1_send_packet(uint8_t opc, uint8_t data0, uint8_t data1, uint8_t data2, uint16_t data34);
-void uart1_send_byte(uint8_t b);
+//Take the oldest received packet into rx_buf, false if there is none
+bool uart1_receive(void);
+//Same, as long as the oldest packet is an opc one
+bool uart1_receive_opc(uint8_t opc);
+//Opcode of the oldest packet, without taking it, 0 if there is none
+uint8_t uart1_peek(void);
+//True while packets wait in the RX queue
+bool uart1_pending(void);
+//Packets queued so far, wraps
+uint8_t uart1_arrivals(void);
+//Nothing on the line or queued either way, no rate change going on
+bool uart1_idle(void);
+//Call every main loop pass: line rate negotiation and fallback
+void uart1_poll(void);
+//Master: find the fastest rate the whole ring can do
+void uart1_baud_negotiate(void);
+bool uart1_baud_busy(void);
+//After a reset: straight back to the rate the ring was running at
+void uart1_baud_resume(uint8_t rate);
+//Current line rate, 0 = 9600 .. 4 = 115200
+uint8_t uart1_baud_index(void);
+/* Frames carry the age of what they tell of, see uart.c. In counts
+ * of timer0_counts(), UART1_AGE_MAX is too old to tell. */
+#define UART1_AGE_MAX   0xFFFF
+//Age of the packet in rx_buf by now
+uint16_t uart1_rx_age(void);
+//.. and the 10ms ticks it was sent late, on top of that
+#define UART1_LATE_MAX  0xFFFF
+uint16_t uart1_rx_late(void);
+//How long ago it came in, the clock before started sending its AGE then
+uint16_t uart1_rx_waited(void);
+/* Queue a packet for sending, returns right away. hops is how many it
+ * made before it got to us, 0 for one of our own. */
+void uart1_send_frame(uint8_t hops, uint16_t age, uint16_t late, uint8_t opc, uint8_t data0, uint8_t data1, uint8_t data2, uint32_t data345, uint8_t data6);
+//Our own, about something that happened age and late ago
+#define uart1_send_aged(age, late, opc, data0, data1, data2, data345, data6) \
+        uart1_send_frame(0, age, late, opc, data0, data1, data2, data345, data6)
+//Our own, about something that happens now
+#define uart1_send_packet(opc, data0, data1, data2, data345) \
+        uart1_send_frame(0, 0, 0, opc, data0, data1, data2, data345, 0)
 
 //Because it is needed in the file containing main
-#ifndef __GNUC__
-void uart1_isr() __interrupt 4 __using 2;
-#endif
+void uart1_isr(void) __interrupt(4) __using(2);
 #endif
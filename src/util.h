@@ -0,0 +1,16 @@
+#ifndef UTIL_H
+#define UTIL_H
+
+#include <stdint.h>
+
+// ds_daytime() wraps at midnight
+#define DAY_SECONDS     86400UL
+
+//v >> shift in one byte, 0xFF when it does not fit
+static inline uint8_t saturate(uint16_t v, uint8_t shift)
+{
+    v >>= shift;
+    return v > 0xFF ? 0xFF : v;
+}
+
+#endif /* UTIL_H */
@@ -4,15 +4,17 @@ import sys, asyncio, aiofiles
 from functools import partial
 import signal
 
-BAUD=9600
+BAUD=9600 ## the clocks only go faster if every hop keeps up, we do not
 
 PORT = sys.argv[1]
 FN_IN = sys.argv[2]
 FN_OUT = sys.argv[3]
 
 SYNC_BYTE = b's' ## from uart.c
-MSG_LEN = 9 ## inferred from uart.c
-OPC = {ord(b'A'):"ASSIGN", ord(b'P'):"PASSON", ord(b'C'):"CLAIM"}
+MSG_LEN = 14 ## SYNC CNTR AGE OPC DATA0..6 LATE_H LATE_L CHECKSUM, see uart.c
+OPC = {ord(b'A'):"ASSIGN", ord(b'P'):"PASSON", ord(b'C'):"CLAIM", ord(b'B'):"BAUD",
+       ord(b'L'):"LINK", ord(b'R'):"RESUME", ord(b'S'):"STATS"}
+COUNT_MS = 12 * 1000 / 11059200 ## timer0 counts, FOSC / 12
 
 print(f"Opening {FN_IN} for reading")
 PIPEIN = aiofiles.open(FN_IN, 'rb')
@@ -21,39 +23,82 @@ PIPEOUT = open(FN_OUT, 'wb')
 
 snooper = None;
 
+## CRC-8, x^8 + x^2 + x + 1, seeded with the SYNC byte, see uart.c
+def crc8(data, crc=SYNC_BYTE[0]):
+    for b in data:
+        crc ^= b
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x07 if crc & 0x80 else crc << 1) & 0xFF
+    return crc
+
 def checksum(msg):
-    cs = sum(SYNC_BYTE + msg[2:8])
-    if cs != msg[8]:
+    if crc8(msg[3:13]) != msg[13]:
         return "CS ERROR"
     return ""
 
+## DATA0..5 of a LINK frame, see linkstat.c
+def link(d):
+    return (f"id={d[0]} hops={d[1]} rtt={d[2]*256*COUNT_MS:.1f}/{d[3]*256*COUNT_MS:.1f}/"
+            f"{d[4]*256*COUNT_MS:.1f}ms held={d[5]*32*COUNT_MS:.2f}ms")
+
+## .. of a STATS frame, one per clock in a pass, see ringstat.c
+def stats(d):
+    return (f"id={d[0]} badcs={d[1]} rxovr={d[2]} btndrop={d[3]} "
+            f"task={d[4]*256*COUNT_MS:.1f}ms isr={d[5]*8*COUNT_MS:.3f}ms")
+
 
 def decode_msg(name, msg):
     #print raw
     hx = msg.hex(' ')
 
-    debug = msg[1]
-    opc = OPC.get(msg[2], "!! ERROR UNKNOWN OPCODE !!")
-    print("opc:", opc, msg[2])
-    next_id = msg[3]
-    nr_of_players = msg[4]
-    ttl = msg[5]
-    rem_time = (msg[6]<<8)|msg[7]
+    hops = msg[1]
+    age = msg[2] ## 256 counts, 255 is that old or older
+    opc = OPC.get(msg[3], "!! ERROR UNKNOWN OPCODE !!")
+    print("opc:", opc, msg[3])
     cs = checksum(msg)
-    cooked = f"[dbg={debug} {opc} nextid={next_id} nplayers={nr_of_players} ttl={ttl} rtime={rem_time} {cs}]"
+    if msg[3] == ord(b'L'):
+        cooked = f"[hops={hops} {opc} {link(msg[4:10])} {cs}]"
+    elif msg[3] == ord(b'S'):
+        cooked = f"[hops={hops} {opc} {stats(msg[4:10])} {cs}]"
+    else:
+        next_id = msg[4]
+        nr_of_players = msg[5]
+        ttl = msg[6]
+        rem_time = (msg[7]<<16)|(msg[8]<<8)|msg[9] ## 10ms ticks
+        move = msg[10]
+        late = (msg[11]<<8)|msg[12] ## 10ms ticks on top of age
+        cooked = (f"[hops={hops} age={age*256*COUNT_MS:.1f}ms late={late*10}ms {opc} nextid={next_id} "
+                  f"nplayers={nr_of_players} ttl={ttl} rtime={rem_time/100:.2f}s move={move} {cs}]")
 
     sys.stderr.write(f"{name}: {msg} ({hx}) {cooked}\n")
 
+## After SYNC a SYNC or ESC byte comes as ESC and the byte ^ 0x20, a SYNC
+## always starts a new frame
+ESC_BYTE = b'\x7d'
+
 class Accumulator:
     def __init__(self, msglen, name):
         self.msglen = msglen
         self.i = 0;
+        self.esc = False
         self.bytes = [0]*msglen
         self.name = name
     def add(self, b):
+        if b == SYNC_BYTE:
+            if self.i != 0:
+                sys.stderr.write(f"{self.name}: frame broke off after {self.i} bytes\n")
+            self.i = 0
+            self.esc = False
+        elif self.i == 0:
+            return
+        elif b == ESC_BYTE:
+            self.esc = True
+            return
+        elif self.esc:
+            b = bytes([b[0] ^ 0x20])
+            self.esc = False
         self.bytes[self.i] = b
-        if self.i != 0 or b == SYNC_BYTE:
-            self.i += 1
+        self.i += 1
         if self.i == self.msglen:
             msg = b''.join(self.bytes)
             decode_msg(self.name, msg)
@@ -89,7 +134,8 @@ class SerialSnoop(asyncio.Protocol):
 
     def data_received(self, data):
         print(f"SERIALIN {data}")
-        self.accu.add(data)
+        for b in data:
+            self.accu.add(bytes([b]))
         try:
             PIPEOUT.write(data)
             PIPEOUT.flush()